@@ -4,10 +4,329 @@
 #include <string>
 #include <stack>
 #include <unordered_set>
+#include <queue>
+#include <limits>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <set>
+#include <list>
+#include <unordered_map>
+#include <cmath>
+#include <stdexcept>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 using namespace std;
 
+#ifdef CITY_PROFILE
+// Hot-path instrumentation, compiled in with -DCITY_PROFILE. Without the macro every
+// PROFILE_* statement expands to nothing and none of this code exists.
+enum ProfileCounter
+{
+    NodesExpandedCounter,
+    EdgesRelaxedCounter,
+    PathsFoundCounter,
+    NodeLookupsCounter,
+    BytesAllocatedCounter,
+    ProfileCounterCount
+};
+
+const char *const profileCounterNames[ProfileCounterCount] = {"nodesExpanded", "edgesRelaxed", "pathsFound", "nodeLookups", "bytesAllocated"};
+
+// Counters and scope timings of every thread. Each thread only writes its own slots
+// (relaxed atomics, no locked instructions), so a dump can read them at any time.
+class Profiler
+{
+public:
+    static const int maxScopes = 64;
+
+    // One completed traced scope; times are nanoseconds since the profiler started and
+    // counters hold what the thread counted while the scope was open
+    class TraceEvent
+    {
+    public:
+        int scope;
+        uint64_t start;
+        uint64_t duration;
+        uint64_t counters[ProfileCounterCount];
+    };
+
+    class ThreadData
+    {
+    public:
+        int id = 0;
+        atomic<uint64_t> counters[ProfileCounterCount];
+        atomic<uint64_t> scopeNanos[maxScopes];
+        atomic<uint64_t> scopeCalls[maxScopes];
+        mutex eventLock;
+        vector<TraceEvent> events;
+
+        ThreadData()
+        {
+            for (auto &counter : counters)
+            {
+                counter.store(0, memory_order_relaxed);
+            }
+            for (int i = 0; i < maxScopes; ++i)
+            {
+                scopeNanos[i].store(0, memory_order_relaxed);
+                scopeCalls[i].store(0, memory_order_relaxed);
+            }
+        }
+
+        static void add(atomic<uint64_t> &value, uint64_t amount)
+        {
+            value.store(value.load(memory_order_relaxed) + amount, memory_order_relaxed);
+        }
+    };
+
+    static Profiler &instance()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    // Data of the calling thread, registered on first use and kept until exit so the
+    // numbers of finished pool workers still show up in a dump
+    ThreadData &thread()
+    {
+        thread_local ThreadData *data = nullptr;
+        if (!data)
+        {
+            lock_guard<mutex> lock(registry);
+            threads.emplace_back(new ThreadData());
+            data = threads.back().get();
+            data->id = int(threads.size()) - 1;
+        }
+        return *data;
+    }
+
+    // Slot of a scope name; called once per PROFILE_* site
+    int scope(const char *name)
+    {
+        lock_guard<mutex> lock(registry);
+        for (size_t i = 0; i < scopeNames.size(); ++i)
+        {
+            if (strcmp(scopeNames[i], name) == 0)
+            {
+                return int(i);
+            }
+        }
+        if (scopeNames.size() == size_t(maxScopes))
+        {
+            throw logic_error("Too many profile scopes");
+        }
+        scopeNames.push_back(name);
+        return int(scopeNames.size()) - 1;
+    }
+
+    uint64_t now() const
+    {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - epoch).count();
+    }
+
+    void count(ProfileCounter counter, uint64_t amount)
+    {
+        ThreadData::add(thread().counters[counter], amount);
+    }
+
+    // Counter totals over all threads, then calls and time per scope
+    void writeMetrics(ostream &out)
+    {
+        lock_guard<mutex> lock(registry);
+        uint64_t counters[ProfileCounterCount] = {};
+        vector<uint64_t> nanos(scopeNames.size(), 0), calls(scopeNames.size(), 0);
+        for (const auto &data : threads)
+        {
+            for (int c = 0; c < ProfileCounterCount; ++c)
+            {
+                counters[c] += data->counters[c].load(memory_order_relaxed);
+            }
+            for (size_t s = 0; s < scopeNames.size(); ++s)
+            {
+                nanos[s] += data->scopeNanos[s].load(memory_order_relaxed);
+                calls[s] += data->scopeCalls[s].load(memory_order_relaxed);
+            }
+        }
+
+        out << "metrics at " << now() / 1e9 << " s, " << threads.size() << " threads" << endl;
+        for (int c = 0; c < ProfileCounterCount; ++c)
+        {
+            out << "  " << profileCounterNames[c] << " " << counters[c] << endl;
+        }
+        for (size_t s = 0; s < scopeNames.size(); ++s)
+        {
+            out << "  " << scopeNames[s] << ": " << calls[s] << " calls, " << nanos[s] / 1e6 << " ms";
+            if (calls[s] > 0)
+            {
+                out << ", " << nanos[s] / 1e3 / calls[s] << " us each";
+            }
+            out << endl;
+        }
+    }
+
+    // Traced scopes in the Chrome trace event format (chrome://tracing, Perfetto)
+    void writeChromeTrace(ostream &out)
+    {
+        lock_guard<mutex> lock(registry);
+        out << "{\"traceEvents\":[";
+        bool first = true;
+        for (const auto &data : threads)
+        {
+            lock_guard<mutex> eventLock(data->eventLock);
+            for (const TraceEvent &event : data->events)
+            {
+                out << (first ? "" : ",") << "\n{\"name\":\"" << scopeNames[event.scope] << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << data->id
+                    << ",\"ts\":" << event.start / 1e3 << ",\"dur\":" << event.duration / 1e3 << ",\"args\":{";
+                for (int c = 0; c < ProfileCounterCount; ++c)
+                {
+                    out << (c ? "," : "") << "\"" << profileCounterNames[c] << "\":" << event.counters[c];
+                }
+                out << "}}";
+                first = false;
+            }
+        }
+        out << "\n],\"displayTimeUnit\":\"ms\"}" << endl;
+    }
+
+private:
+    chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+    mutex registry;
+    vector<unique_ptr<ThreadData>> threads;
+    vector<const char *> scopeNames;
+};
+
+// Times the enclosing block. Every scope adds to its per-thread totals; a traced one
+// also records a trace event with the counters of the thread while it was open. Hot
+// scopes (inside per-node or per-path loops) are not traced so the buffer stays small.
+class ProfileScope
+{
+private:
+    Profiler::ThreadData &data;
+    int scope;
+    bool traced;
+    uint64_t start;
+    uint64_t counters[ProfileCounterCount];
+
+public:
+    ProfileScope(int _scope, bool _traced) : data(Profiler::instance().thread()), scope(_scope), traced(_traced)
+    {
+        if (traced)
+        {
+            for (int c = 0; c < ProfileCounterCount; ++c)
+            {
+                counters[c] = data.counters[c].load(memory_order_relaxed);
+            }
+        }
+        start = Profiler::instance().now();
+    }
+
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+
+    ~ProfileScope()
+    {
+        uint64_t duration = Profiler::instance().now() - start;
+        Profiler::ThreadData::add(data.scopeNanos[scope], duration);
+        Profiler::ThreadData::add(data.scopeCalls[scope], 1);
+        if (traced)
+        {
+            Profiler::TraceEvent event = {scope, start, duration, {}};
+            for (int c = 0; c < ProfileCounterCount; ++c)
+            {
+                event.counters[c] = data.counters[c].load(memory_order_relaxed) - counters[c];
+            }
+            lock_guard<mutex> lock(data.eventLock);
+            data.events.push_back(event);
+        }
+    }
+};
+
+// Writes the metrics to out every interval until destroyed
+class PeriodicMetricsDump
+{
+private:
+    mutex lock;
+    condition_variable wake;
+    bool stopping = false;
+    thread worker;
+
+public:
+    PeriodicMetricsDump(ostream &out, chrono::milliseconds interval)
+        : worker([this, &out, interval]()
+                 {
+                     unique_lock<mutex> guard(lock);
+                     while (!wake.wait_for(guard, interval, [this]() { return stopping; }))
+                     {
+                         Profiler::instance().writeMetrics(out);
+                     } })
+    {
+    }
+
+    ~PeriodicMetricsDump()
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        worker.join();
+    }
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE_AS(name, traced)                                                      \
+    static const int PROFILE_CONCAT(profileSlot, __LINE__) = Profiler::instance().scope(name); \
+    ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(PROFILE_CONCAT(profileSlot, __LINE__), traced)
+#define PROFILE_SCOPE(name) PROFILE_SCOPE_AS(name, true)
+#define PROFILE_HOT_SCOPE(name) PROFILE_SCOPE_AS(name, false)
+#define PROFILE_COUNT(counter, amount) Profiler::instance().count(counter, amount)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_HOT_SCOPE(name)
+#define PROFILE_COUNT(counter, amount)
+#endif
+
 
 int Totalnode = 7;
+
+// Ranges of the randomly generated edge weights
+const int Dlower = 3;
+const int Dupper = 10;
+const int RLlower = 0;
+const int RLupper = 4;
+const int Tlower = 2;
+const int Tupper = 8;
+
+// Convenience cost of a single edge, the building block of every path score
+inline double convenienceCost(int distance, int traffic, int redLight)
+{
+    const double epsilon = 1e-2;
+    // Adjust weights to minimize distance, red light, and traffic
+    return 0.5 / (distance + epsilon) + 0.3 / (redLight + epsilon) + 0.2 / (traffic + epsilon);
+}
+
 class EdgeInfo
 {
 public:
@@ -19,6 +338,136 @@ public:
         : distance(_distance), traffic(_traffic), redLight(_redLight) {}
 };
 
+// Monotonic arena for the graph's nodes, edges and adjacency lists. Memory comes from
+// large blocks that are only released together when the arena dies, so building a
+// graph costs no malloc per element and tearing it down costs one free per block.
+// Freed small chunks (outgrown adjacency vectors) go to per-size free lists and are
+// handed out again. Objects created here never have their destructors run, so they
+// must not own memory outside the arena.
+class GraphArena
+{
+private:
+    static const size_t firstBlockBytes = 64 * 1024;
+    static const size_t maxBlockBytes = 4 * 1024 * 1024;
+    static const size_t sizeClassBytes = 8;
+    static const size_t sizeClassCount = 64; // chunks up to 512 bytes are recycled
+
+    vector<char *> blocks;
+    char *cursor = nullptr;
+    char *blockEnd = nullptr;
+    size_t nextBlockBytes = firstBlockBytes;
+    size_t reserved = 0;
+    size_t used = 0;
+    void *freeLists[sizeClassCount] = {};
+
+    static bool recyclable(size_t bytes, size_t alignment)
+    {
+        return bytes > 0 && bytes % sizeClassBytes == 0 && bytes <= sizeClassBytes * sizeClassCount && alignment <= sizeClassBytes;
+    }
+
+public:
+    GraphArena() {}
+    GraphArena(const GraphArena &) = delete;
+    GraphArena &operator=(const GraphArena &) = delete;
+
+    ~GraphArena()
+    {
+        for (char *block : blocks)
+        {
+            ::operator delete(block);
+        }
+    }
+
+    void *allocate(size_t bytes, size_t alignment)
+    {
+        used += bytes;
+        PROFILE_COUNT(BytesAllocatedCounter, bytes);
+        if (recyclable(bytes, alignment))
+        {
+            void *&head = freeLists[bytes / sizeClassBytes - 1];
+            if (head)
+            {
+                void *chunk = head;
+                head = *static_cast<void **>(chunk);
+                return chunk;
+            }
+            alignment = sizeClassBytes;
+        }
+
+        uintptr_t address = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~uintptr_t(alignment - 1);
+        if (!cursor || address + bytes > reinterpret_cast<uintptr_t>(blockEnd))
+        {
+            size_t blockBytes = max(nextBlockBytes, bytes + alignment);
+            nextBlockBytes = min(nextBlockBytes * 2, size_t(maxBlockBytes));
+            char *block = static_cast<char *>(::operator new(blockBytes));
+            blocks.push_back(block);
+            reserved += blockBytes;
+            cursor = block;
+            blockEnd = block + blockBytes;
+            address = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~uintptr_t(alignment - 1);
+        }
+        cursor = reinterpret_cast<char *>(address + bytes);
+        return reinterpret_cast<void *>(address);
+    }
+
+    void deallocate(void *chunk, size_t bytes)
+    {
+        used -= bytes;
+        if (recyclable(bytes, 1))
+        {
+            void *&head = freeLists[bytes / sizeClassBytes - 1];
+            *static_cast<void **>(chunk) = head;
+            head = chunk;
+        }
+    }
+
+    template <class T, class... Args>
+    T *create(Args &&...args)
+    {
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    size_t reservedBytes() const { return reserved; } // exact size of all blocks
+    size_t usedBytes() const { return used; }         // bytes handed out and not freed
+    size_t blockCount() const { return blocks.size(); }
+};
+
+// Standard allocator on top of a GraphArena; without an arena it uses the global heap
+template <class T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+    GraphArena *arena;
+
+    ArenaAllocator(GraphArena *_arena = nullptr) : arena(_arena) {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+    T *allocate(size_t count)
+    {
+        size_t bytes = count * sizeof(T);
+        return static_cast<T *>(arena ? arena->allocate(bytes, alignof(T)) : ::operator new(bytes));
+    }
+
+    void deallocate(T *pointer, size_t count)
+    {
+        if (arena)
+        {
+            arena->deallocate(pointer, count * sizeof(T));
+        }
+        else
+        {
+            ::operator delete(pointer);
+        }
+    }
+
+    template <class U>
+    bool operator==(const ArenaAllocator<U> &other) const { return arena == other.arena; }
+    template <class U>
+    bool operator!=(const ArenaAllocator<U> &other) const { return arena != other.arena; }
+};
+
 class CityNode;
 
 class CityEdge
@@ -26,324 +475,7903 @@ class CityEdge
 public:
     CityNode *source;
     CityNode *destination;
-    EdgeInfo info;
+    EdgeInfo info;  // change through setInfo so cost stays in sync
+    double cost;    // cached convenienceCost of info
+
+    CityEdge(CityNode *_source, CityNode *_destination, const EdgeInfo &_info)
+        : source(_source), destination(_destination), info(_info), cost(convenienceCost(_info.distance, _info.traffic, _info.redLight)) {}
 
-    CityEdge(CityNode *_source, CityNode *_destination, const EdgeInfo &_info) : source(_source), destination(_destination), info(_info) {}
+    void setInfo(const EdgeInfo &_info)
+    {
+        info = _info;
+        cost = convenienceCost(info.distance, info.traffic, info.redLight);
+    }
 };
 
 class CityNode
 {
 public:
     int id;
-    string type;
-    vector<CityEdge *> edges;
-    CityNode(int _id, const string &_type) : id(_id), type(_type) {}
+    int index; // position of the node inside CityGraph::city
+    const char *type; // not owned: interned by CityGraph, or a string literal
+    double x, y;      // map coordinates, NaN when unknown
+    vector<CityEdge *, ArenaAllocator<CityEdge *>> edges;
+    CityNode(int _id, const char *_type, GraphArena *arena = nullptr, double _x = numeric_limits<double>::quiet_NaN(), double _y = numeric_limits<double>::quiet_NaN())
+        : id(_id), index(-1), type(_type), x(_x), y(_y), edges(ArenaAllocator<CityEdge *>(arena)) {}
 };
 
-class CityGraph
+// A path stored as the CSR slots of its edges; start is the dense index of the first node
+class EdgePath
 {
+public:
+    int start = -1;
+    vector<int> edges;
+};
+
+// Many edge paths packed back to back, so a whole batch is scored in one pass
+class PathBatch
+{
+public:
+    vector<int> starts;
+    vector<int> edges;
+    vector<int> offsets{0}; // path i uses edges[offsets[i] .. offsets[i + 1] - 1]
+
+    size_t size() const { return starts.size(); }
+
+    void add(int start, const vector<int> &pathEdges)
+    {
+        starts.push_back(start);
+        edges.insert(edges.end(), pathEdges.begin(), pathEdges.end());
+        offsets.push_back(edges.size());
+    }
+
+    EdgePath get(size_t i) const
+    {
+        EdgePath path;
+        path.start = starts[i];
+        path.edges.assign(edges.begin() + offsets[i], edges.begin() + offsets[i + 1]);
+        return path;
+    }
+
+    void clear()
+    {
+        starts.clear();
+        edges.clear();
+        offsets.assign(1, 0);
+    }
+};
 
+// Array of a CompactCityGraph column. It either owns its values or views values that
+// live elsewhere (a memory-mapped graph file); a view is copied into owned storage
+// before it is resized. Copies always own their values.
+template <class T>
+class Column
+{
 private:
-    vector<CityNode *> city;
+    vector<T> owned;
+    T *first = nullptr;
+    size_t count = 0;
 
-    // Helper function to find a node by ID
-    CityNode *findNode(int nodeId)
+    void sync()
     {
-        for (CityNode *node : city)
+        first = owned.data();
+        count = owned.size();
+    }
+
+    void detach()
+    {
+        if (first != owned.data())
         {
-            if (node->id == nodeId)
-            {
-                return node;
-            }
+            owned.assign(first, first + count);
+            sync();
         }
-        return nullptr;
     }
 
-    void findAllPathsHelper(CityNode *currentNode, CityNode *endNode, vector<int> &currentPath, vector<vector<int>> &allPaths, unordered_set<int> &visitedNodes)
+public:
+    Column() {}
+    Column(size_t n, const T &value) : owned(n, value) { sync(); }
+    Column(const Column &other) : owned(other.begin(), other.end()) { sync(); }
+    Column(Column &&other) noexcept : owned(std::move(other.owned)), first(other.first), count(other.count)
+    {
+        other.sync();
+    }
+
+    Column &operator=(Column other)
     {
-        currentPath.push_back(currentNode->id);
-        visitedNodes.insert(currentNode->id);
+        owned.swap(other.owned);
+        swap(first, other.first);
+        swap(count, other.count);
+        return *this;
+    }
 
-        if (currentNode == endNode)
+    // Point at count values owned by someone else, who has to keep them alive
+    void view(T *values, size_t n)
+    {
+        vector<T>().swap(owned);
+        first = values;
+        count = n;
+    }
+
+    bool isView() const { return first != owned.data(); }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    size_t capacity() const { return isView() ? count : owned.capacity(); }
+    T *data() { return first; }
+    const T *data() const { return first; }
+    T *begin() { return first; }
+    T *end() { return first + count; }
+    const T *begin() const { return first; }
+    const T *end() const { return first + count; }
+    T &operator[](size_t i) { return first[i]; }
+    const T &operator[](size_t i) const { return first[i]; }
+    T &back() { return first[count - 1]; }
+
+    void reserve(size_t n)
+    {
+        detach();
+        owned.reserve(n);
+        sync();
+    }
+
+    void push_back(const T &value)
+    {
+        detach();
+        owned.push_back(value);
+        sync();
+    }
+
+    void resize(size_t n)
+    {
+        detach();
+        owned.resize(n);
+        sync();
+    }
+
+    void assign(size_t n, const T &value)
+    {
+        owned.assign(n, value);
+        sync();
+    }
+};
+
+// Read-only file mapped into memory. Pages are mapped copy-on-write, so writing to
+// them (live traffic patches) stays private to the process and other processes keep
+// sharing the page cache. Falls back to reading the file where mmap is unavailable.
+class MappedFile
+{
+private:
+    vector<char> buffer;
+
+public:
+    char *data = nullptr;
+    size_t size = 0;
+
+    explicit MappedFile(const string &path)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
         {
-            // Found a path, add it to the list
-            allPaths.push_back(currentPath);
+            throw runtime_error("cannot open " + path);
         }
-        else
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+        {
+            close(fd);
+            throw runtime_error("cannot stat " + path);
+        }
+        size = info.st_size;
+        if (size > 0)
         {
-            // Continue DFS for unvisited neighbors
-            for (CityEdge *edge : currentNode->edges)
+            void *address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (address == MAP_FAILED)
             {
-                if (visitedNodes.find(edge->destination->id) == visitedNodes.end())
-                {
-                    findAllPathsHelper(edge->destination, endNode, currentPath, allPaths, visitedNodes);
-                }
+                close(fd);
+                throw runtime_error("cannot map " + path);
             }
+            data = static_cast<char *>(address);
+        }
+        close(fd);
+#else
+        ifstream file(path, ios::binary);
+        if (!file)
+        {
+            throw runtime_error("cannot open " + path);
+        }
+        buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        data = buffer.data();
+        size = buffer.size();
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        if (data)
+        {
+            munmap(data, size);
         }
+#endif
+    }
+};
+
+// Sections of a binary graph file, in file order
+enum GraphFileSection
+{
+    NodeIdsSection,
+    NodeTypesSection, // per node, index into the type names
+    OffsetsSection,
+    TargetsSection,
+    DistanceSection,
+    TrafficSection,
+    RedLightSection,
+    CostSection,
+    XSection, // per node coordinates, NaN when unknown
+    YSection,
+    TypeNamesSection, // typeCount NUL-terminated strings
+    GraphFileSectionCount
+};
+
+// Header of a binary graph file. The sections follow at the listed byte offsets,
+// each 64-byte aligned so the columns can be used straight from a mapping. The file
+// is written in the byte order of the machine that wrote it and refused elsewhere.
+class GraphFileHeader
+{
+public:
+    static const uint32_t currentVersion = 2;
+    static const uint32_t byteOrderMark = 0x01020304;
+
+    char magic[8];
+    uint32_t formatVersion;
+    uint32_t byteOrder;
+    uint64_t nodeCount;
+    uint64_t edgeCount;
+    uint64_t typeCount;
+    uint64_t fileBytes;
+    uint64_t sections[GraphFileSectionCount];
+    uint64_t sectionBytes[GraphFileSectionCount];
+    uint64_t payloadChecksum; // over all bytes after the header
+    uint64_t headerChecksum;  // over the header up to this field
+};
+
+const char graphFileMagic[8] = {'C', 'I', 'T', 'Y', 'C', 'S', 'R', '\0'};
 
-        currentPath.pop_back();
-        visitedNodes.erase(currentNode->id);
+// 64-bit checksum of a byte range, eight bytes per step
+uint64_t checksum64(const char *data, size_t bytes)
+{
+    uint64_t hash = 0x9e3779b97f4a7c15ull ^ bytes;
+    size_t i = 0;
+    for (; i + 8 <= bytes; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+        hash ^= hash >> 29;
+    }
+    for (; i < bytes; ++i)
+    {
+        hash = (hash ^ uint8_t(data[i])) * 0x100000001b3ull;
     }
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    return hash ^ (hash >> 33);
+}
+
+class SearchStats
+{
+public:
+    size_t nodesExpanded = 0; // nodes whose outgoing edges were scanned
+    size_t branchesCut = 0;   // edges not followed because of a limit or a bound
+    size_t pathsFound = 0;    // complete paths that improved on the best so far
+};
+
+// Frozen compressed-sparse-row (CSR) form of the city graph.
+// Nodes are numbered densely by CityNode::index and the outgoing edges of node v are
+// the slots offsets[v] .. offsets[v + 1] - 1 of every edge column. Weights are kept as
+// separate columns so a traversal only touches the arrays it actually needs.
+class CompactCityGraph
+{
+public:
+    Column<int> nodeIds;  // dense index -> node id
+    Column<int> offsets;  // nodeCount() + 1 entries
+    Column<int> targets;  // dense index of each edge destination
+    Column<int> distance;
+    Column<int> traffic;
+    Column<int> redLight;
+    Column<double> cost;  // cached convenience cost of every edge
+    Column<double> x;     // node coordinates, NaN when unknown
+    Column<double> y;
+    shared_ptr<MappedFile> file; // set when the columns view a graph file
+
+    CompactCityGraph() : offsets(1, 0) {}
+
+    explicit CompactCityGraph(const vector<CityNode *> &nodes)
+    {
+        size_t totalEdges = 0;
+        for (CityNode *node : nodes)
+        {
+            totalEdges += node->edges.size();
+        }
+
+        nodeIds.reserve(nodes.size());
+        x.reserve(nodes.size());
+        y.reserve(nodes.size());
+        offsets.reserve(nodes.size() + 1);
+        targets.reserve(totalEdges);
+        distance.reserve(totalEdges);
+        traffic.reserve(totalEdges);
+        redLight.reserve(totalEdges);
+        cost.reserve(totalEdges);
+
+        offsets.push_back(0);
+        for (CityNode *node : nodes)
+        {
+            nodeIds.push_back(node->id);
+            x.push_back(node->x);
+            y.push_back(node->y);
+            for (CityEdge *edge : node->edges)
+            {
+                targets.push_back(edge->destination->index);
+                distance.push_back(edge->info.distance);
+                traffic.push_back(edge->info.traffic);
+                redLight.push_back(edge->info.redLight);
+                cost.push_back(edge->cost);
+            }
+            offsets.push_back(targets.size());
+        }
+    }
+
+    int nodeCount() const { return nodeIds.size(); }
+    int edgeCount() const { return targets.size(); }
+
+    double edgeCost(int edge) const
+    {
+        return cost[edge];
+    }
+
+    // Sum of the cached costs of `count` edge slots
+    double pathCost(const int *edges, size_t count) const
+    {
+        const double *costs = cost.data();
+        double sum0 = 0.0, sum1 = 0.0, sum2 = 0.0, sum3 = 0.0;
+        size_t i = 0;
+#ifdef __AVX2__
+        __m256d lanes = _mm256_setzero_pd();
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i slots = _mm_loadu_si128(reinterpret_cast<const __m128i *>(edges + i));
+            lanes = _mm256_add_pd(lanes, _mm256_i32gather_pd(costs, slots, 8));
+        }
+        double partial[4];
+        _mm256_storeu_pd(partial, lanes);
+        sum0 = partial[0];
+        sum1 = partial[1];
+        sum2 = partial[2];
+        sum3 = partial[3];
+#endif
+        // Four independent accumulators so the compiler can vectorize the reduction
+        for (; i + 4 <= count; i += 4)
+        {
+            sum0 += costs[edges[i]];
+            sum1 += costs[edges[i + 1]];
+            sum2 += costs[edges[i + 2]];
+            sum3 += costs[edges[i + 3]];
+        }
+        for (; i < count; ++i)
+        {
+            sum0 += costs[edges[i]];
+        }
+        return (sum0 + sum1) + (sum2 + sum3);
+    }
+
+    double pathCost(const EdgePath &path) const
+    {
+        return pathCost(path.edges.data(), path.edges.size());
+    }
+
+    // Score every path of a batch: scores[i] is the cost of path i
+    void scoreBatch(const PathBatch &batch, vector<double> &scores) const
+    {
+        scores.resize(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            scores[i] = pathCost(batch.edges.data() + batch.offsets[i], batch.offsets[i + 1] - batch.offsets[i]);
+        }
+    }
+
+    // Node ids visited by an edge path
+    vector<int> nodePath(int start, const int *edges, size_t count) const
+    {
+        vector<int> path;
+        path.reserve(count + 1);
+        path.push_back(nodeIds[start]);
+        for (size_t i = 0; i < count; ++i)
+        {
+            path.push_back(nodeIds[targets[edges[i]]]);
+        }
+        return path;
+    }
+
+    vector<int> nodePath(const EdgePath &path) const
+    {
+        return nodePath(path.start, path.edges.data(), path.edges.size());
+    }
+
+    // Dijkstra from source to target over the cached edge costs, skipping banned nodes and
+    // edges when given. Fills path (start stays -1 when target is unreachable) and returns its
+    // cost; stats, when given, counts the settled nodes.
+    double shortestPath(int source, int target, const vector<char> *bannedNodes, const vector<char> *bannedEdges, EdgePath &path, SearchStats *stats = nullptr) const
+    {
+        PROFILE_HOT_SCOPE("shortestPath");
+        vector<double> best(nodeCount(), numeric_limits<double>::infinity());
+        vector<int> previous(nodeCount(), -1);
+        vector<int> previousEdge(nodeCount(), -1);
+        typedef pair<double, int> QueueEntry;
+        priority_queue<QueueEntry, vector<QueueEntry>, greater<QueueEntry>> queue;
+
+        best[source] = 0.0;
+        queue.push(QueueEntry(0.0, source));
+        while (!queue.empty())
+        {
+            QueueEntry top = queue.top();
+            queue.pop();
+            int node = top.second;
+            if (top.first > best[node])
+            {
+                continue; // stale queue entry
+            }
+            if (stats)
+            {
+                ++stats->nodesExpanded;
+            }
+            PROFILE_COUNT(NodesExpandedCounter, 1);
+            if (node == target)
+            {
+                break;
+            }
+            for (int e = offsets[node]; e < offsets[node + 1]; ++e)
+            {
+                int next = targets[e];
+                if ((bannedEdges && (*bannedEdges)[e]) || (bannedNodes && (*bannedNodes)[next]))
+                {
+                    continue;
+                }
+                double candidate = top.first + edgeCost(e);
+                if (candidate < best[next])
+                {
+                    PROFILE_COUNT(EdgesRelaxedCounter, 1);
+                    best[next] = candidate;
+                    previous[next] = node;
+                    previousEdge[next] = e;
+                    queue.push(QueueEntry(candidate, next));
+                }
+            }
+        }
+
+        path.start = -1;
+        path.edges.clear();
+        if (best[target] == numeric_limits<double>::infinity())
+        {
+            return best[target];
+        }
+        path.start = source;
+        for (int node = target; node != source; node = previous[node])
+        {
+            path.edges.push_back(previousEdge[node]);
+        }
+        reverse(path.edges.begin(), path.edges.end());
+        return best[target];
+    }
+
+    // Node an edge slot leaves from (binary search over offsets)
+    int edgeSource(int edge) const
+    {
+        return int(upper_bound(offsets.begin(), offsets.end(), edge) - offsets.begin()) - 1;
+    }
+
+    // Slot of the cheapest edge source -> destination, or -1 if there is none
+    int findCheapestEdge(int source, int destination) const
+    {
+        int best = -1;
+        for (int e = offsets[source]; e < offsets[source + 1]; ++e)
+        {
+            if (targets[e] == destination && (best == -1 || cost[e] < cost[best]))
+            {
+                best = e;
+            }
+        }
+        return best;
+    }
+
+    // The same graph with every edge turned around. When forwardSlots is given it
+    // receives, for every reversed edge, the slot of the original edge.
+    CompactCityGraph reversed(vector<int> *forwardSlots = nullptr) const
+    {
+        CompactCityGraph reverse;
+        int n = nodeCount();
+        reverse.nodeIds = nodeIds;
+        reverse.x = x;
+        reverse.y = y;
+        reverse.offsets.assign(n + 1, 0);
+        for (int e = 0; e < edgeCount(); ++e)
+        {
+            ++reverse.offsets[targets[e] + 1];
+        }
+        for (int v = 0; v < n; ++v)
+        {
+            reverse.offsets[v + 1] += reverse.offsets[v];
+        }
+
+        reverse.targets.resize(edgeCount());
+        reverse.distance.resize(edgeCount());
+        reverse.traffic.resize(edgeCount());
+        reverse.redLight.resize(edgeCount());
+        reverse.cost.resize(edgeCount());
+        if (forwardSlots)
+        {
+            forwardSlots->resize(edgeCount());
+        }
+        vector<int> fill(reverse.offsets.begin(), reverse.offsets.end() - 1);
+        for (int v = 0; v < n; ++v)
+        {
+            for (int e = offsets[v]; e < offsets[v + 1]; ++e)
+            {
+                int slot = fill[targets[e]]++;
+                reverse.targets[slot] = v;
+                reverse.distance[slot] = distance[e];
+                reverse.traffic[slot] = traffic[e];
+                reverse.redLight[slot] = redLight[e];
+                reverse.cost[slot] = cost[e];
+                if (forwardSlots)
+                {
+                    (*forwardSlots)[slot] = e;
+                }
+            }
+        }
+        return reverse;
+    }
+
+    // Bytes held by the arrays (excluding the object itself)
+    size_t memoryBytes() const
+    {
+        return (nodeIds.capacity() + offsets.capacity() + targets.capacity() + distance.capacity() + traffic.capacity() + redLight.capacity()) * sizeof(int) +
+               (cost.capacity() + x.capacity() + y.capacity()) * sizeof(double);
+    }
+};
+
+// A path handed to a path visitor while it is being enumerated. It points into the
+// enumerator's working state, so it is only valid during the visitor call.
+class PathView
+{
+public:
+    const CompactCityGraph *graph;
+    int start;
+    const int *edges;
+    size_t edgeCount;
+    double cost;
+
+    vector<int> nodeIds() const { return graph->nodePath(start, edges, edgeCount); }
+};
+
+// Called once per enumerated path; return false to stop the enumeration
+typedef function<bool(const PathView &)> PathVisitor;
+
+// Keeps the K cheapest paths seen so far in a bounded max-heap, so memory stays
+// O(K * path length) however many paths are offered.
+class TopKPaths
+{
+private:
+    size_t k;
+    vector<pair<double, vector<int>>> heap; // max-heap on cost
+
+public:
+    explicit TopKPaths(size_t _k) : k(_k) {}
+
+    void offer(const PathView &path)
+    {
+        if (k == 0 || (heap.size() == k && path.cost >= heap.front().first))
+        {
+            return;
+        }
+        if (heap.size() == k)
+        {
+            pop_heap(heap.begin(), heap.end());
+            heap.pop_back();
+        }
+        heap.push_back(make_pair(path.cost, path.nodeIds()));
+        push_heap(heap.begin(), heap.end());
+    }
+
+    // Usable directly as a PathVisitor
+    PathVisitor visitor()
+    {
+        return [this](const PathView &path)
+        {
+            offer(path);
+            return true;
+        };
+    }
+
+    size_t size() const { return heap.size(); }
+
+    // Kept paths, cheapest first
+    vector<pair<double, vector<int>>> sorted() const
+    {
+        vector<pair<double, vector<int>>> result = heap;
+        sort_heap(result.begin(), result.end());
+        return result;
+    }
+};
+
+// Fixed-size work-stealing thread pool.
+// Every worker owns a deque: it pops its own newest task (good locality for tasks that
+// split themselves into subtasks) and, when empty, steals the oldest task of another
+// worker, which tends to be the largest remaining piece of work.
+class ThreadPool
+{
+private:
+    class Worker
+    {
+    public:
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+
+    vector<unique_ptr<Worker>> workers;
+    vector<thread> threads;
+    atomic<size_t> pending{0}; // submitted and not finished yet
+    atomic<size_t> queued{0};  // sitting in a deque
+    atomic<size_t> nextWorker{0};
+    mutex sleepLock;
+    condition_variable wakeUp;
+    condition_variable allDone;
+    bool stopping = false;
+
+    static thread_local ThreadPool *currentPool;
+    static thread_local int currentWorker;
+
+    bool popTask(int index, function<void()> &task)
+    {
+        Worker &own = *workers[index];
+        {
+            lock_guard<mutex> guard(own.lock);
+            if (!own.tasks.empty())
+            {
+                task = move(own.tasks.back());
+                own.tasks.pop_back();
+                --queued;
+                return true;
+            }
+        }
+        for (size_t k = 1; k < workers.size(); ++k)
+        {
+            Worker &victim = *workers[(index + k) % workers.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if (!victim.tasks.empty())
+            {
+                task = move(victim.tasks.front());
+                victim.tasks.pop_front();
+                --queued;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(int index)
+    {
+        currentPool = this;
+        currentWorker = index;
+        function<void()> task;
+        while (true)
+        {
+            if (popTask(index, task))
+            {
+                task();
+                task = nullptr;
+                if (--pending == 0)
+                {
+                    lock_guard<mutex> guard(sleepLock);
+                    allDone.notify_all();
+                }
+                continue;
+            }
+            unique_lock<mutex> guard(sleepLock);
+            wakeUp.wait(guard, [this]
+                        { return stopping || queued > 0; });
+            if (stopping && queued == 0)
+            {
+                return;
+            }
+        }
+    }
+
+public:
+    explicit ThreadPool(int threadCount = thread::hardware_concurrency())
+    {
+        threadCount = max(threadCount, 1);
+        for (int i = 0; i < threadCount; ++i)
+        {
+            workers.push_back(unique_ptr<Worker>(new Worker()));
+        }
+        for (int i = 0; i < threadCount; ++i)
+        {
+            threads.push_back(thread(&ThreadPool::workerLoop, this, i));
+        }
+    }
+
+    ~ThreadPool()
+    {
+        wait();
+        {
+            lock_guard<mutex> guard(sleepLock);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        for (thread &worker : threads)
+        {
+            worker.join();
+        }
+    }
+
+    // Queue a task; tasks submitted from a worker go to that worker's own deque
+    void submit(function<void()> task)
+    {
+        ++pending;
+        int index = currentPool == this ? currentWorker : int(nextWorker++ % workers.size());
+        {
+            // Counted under the deque lock, so no thief can take the task (and count
+            // it down) before it was counted
+            lock_guard<mutex> guard(workers[index]->lock);
+            ++queued;
+            workers[index]->tasks.push_back(move(task));
+        }
+        {
+            // A worker that just saw queued == 0 holds this lock until it sleeps, so
+            // the wake-up cannot fall between its check and its wait
+            lock_guard<mutex> guard(sleepLock);
+        }
+        wakeUp.notify_one();
+    }
+
+    // Block until every submitted task (including tasks they submitted) has finished.
+    // Not callable from a task of this pool: the task itself would never finish.
+    void wait()
+    {
+        if (workerIndex() != -1)
+        {
+            throw logic_error("ThreadPool::wait called from one of its own tasks");
+        }
+        unique_lock<mutex> guard(sleepLock);
+        allDone.wait(guard, [this]
+                     { return pending == 0; });
+    }
+
+    int size() const { return workers.size(); }
+    size_t queuedTasks() const { return queued; }
+
+    // Index of the calling worker thread in this pool, or -1 for other threads
+    int workerIndex() const { return currentPool == this ? currentWorker : -1; }
+};
+
+thread_local ThreadPool *ThreadPool::currentPool = nullptr;
+thread_local int ThreadPool::currentWorker = -1;
+
+// Maps node ids to dense node indexes in O(1).
+// While ids stay dense (the usual 1..N numbering) they index a plain array directly;
+// as soon as an id would make that array mostly empty, the index moves every entry
+// into an open-addressing hash table with linear probing.
+class NodeIndex
+{
+private:
+    bool useDirect = true;
+    vector<int> direct;           // id -> index, -1 when absent
+    vector<pair<int, int>> slots; // (id, index), index -1 when free, so every int is a valid id
+    size_t count = 0;
+
+    size_t slotFor(int id) const
+    {
+        // murmur3 finalizer so ids that only differ in high bits still spread out;
+        // slots.size() is a power of two
+        uint32_t h = uint32_t(id);
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35u;
+        h ^= h >> 16;
+        return h & (slots.size() - 1);
+    }
+
+    void insertSlot(int id, int index)
+    {
+        size_t slot = slotFor(id);
+        while (slots[slot].second != -1)
+        {
+            slot = (slot + 1) & (slots.size() - 1);
+        }
+        slots[slot] = make_pair(id, index);
+    }
+
+    void growSlots(size_t capacity)
+    {
+        vector<pair<int, int>> old;
+        old.swap(slots);
+        slots.assign(capacity, make_pair(0, -1));
+        for (const auto &entry : old)
+        {
+            if (entry.second != -1)
+            {
+                insertSlot(entry.first, entry.second);
+            }
+        }
+    }
+
+    void switchToHash()
+    {
+        size_t capacity = 16;
+        while (capacity < 2 * (count + 1))
+        {
+            capacity *= 2;
+        }
+        slots.assign(capacity, make_pair(0, -1));
+        for (size_t id = 0; id < direct.size(); ++id)
+        {
+            if (direct[id] != -1)
+            {
+                insertSlot(id, direct[id]);
+            }
+        }
+        vector<int>().swap(direct);
+        useDirect = false;
+    }
+
+public:
+    // Dense index of a node id, or -1 if the id is unknown
+    int find(int id) const
+    {
+        PROFILE_COUNT(NodeLookupsCounter, 1);
+        if (useDirect)
+        {
+            return id >= 0 && size_t(id) < direct.size() ? direct[id] : -1;
+        }
+        size_t slot = slotFor(id);
+        while (slots[slot].second != -1)
+        {
+            if (slots[slot].first == id)
+            {
+                return slots[slot].second;
+            }
+            slot = (slot + 1) & (slots.size() - 1);
+        }
+        return -1;
+    }
+
+    // Register id -> index; the first registration of an id wins
+    void insert(int id, int index)
+    {
+        if (find(id) != -1)
+        {
+            return;
+        }
+        if (useDirect && (id < 0 || size_t(id) >= 2 * (count + 1) + 1024))
+        {
+            switchToHash();
+        }
+        if (useDirect)
+        {
+            if (size_t(id) >= direct.size())
+            {
+                direct.resize(max(size_t(id) + 1, direct.size() * 2), -1);
+            }
+            direct[id] = index;
+        }
+        else
+        {
+            if (2 * (count + 1) > slots.size())
+            {
+                growSlots(slots.size() * 2);
+            }
+            insertSlot(id, index);
+        }
+        ++count;
+    }
+
+    bool isDirect() const { return useDirect; }
+};
+
+// Reusable Dijkstra state. Labels carry a generation stamp, so starting a new search
+// is O(1) instead of clearing arrays the size of the graph, and the heap keeps its
+// capacity: repeated searches only pay for the nodes they touch.
+class SearchWorkspace
+{
+public:
+    vector<double> cost;
+    vector<int> parentEdge;
+    vector<uint32_t> stamp;
+    uint32_t generation = 0;
+    vector<pair<double, int>> heap; // min-heap through greater<>
+
+    void reset(int nodeCount)
+    {
+        if (int(stamp.size()) != nodeCount)
+        {
+            PROFILE_COUNT(BytesAllocatedCounter, uint64_t(nodeCount) * (sizeof(double) + sizeof(int) + sizeof(stamp[0])));
+            cost.assign(nodeCount, 0.0);
+            parentEdge.assign(nodeCount, -1);
+            stamp.assign(nodeCount, 0);
+            generation = 0;
+        }
+        if (++generation == 0)
+        {
+            fill(stamp.begin(), stamp.end(), 0);
+            generation = 1;
+        }
+        heap.clear();
+    }
+
+    bool reached(int node) const { return stamp[node] == generation; }
+
+    double costOf(int node) const
+    {
+        return reached(node) ? cost[node] : numeric_limits<double>::infinity();
+    }
+
+    // Lower the label of node and queue it
+    void relax(int node, double newCost, int edge)
+    {
+        relax(node, newCost, edge, newCost);
+    }
+
+    // Same, queued by key instead of its cost (cost plus a potential for A*)
+    void relax(int node, double newCost, int edge, double key)
+    {
+        stamp[node] = generation;
+        cost[node] = newCost;
+        parentEdge[node] = edge;
+        heap.push_back(make_pair(key, node));
+        push_heap(heap.begin(), heap.end(), greater<pair<double, int>>());
+    }
+
+    pair<double, int> pop()
+    {
+        pop_heap(heap.begin(), heap.end(), greater<pair<double, int>>());
+        pair<double, int> top = heap.back();
+        heap.pop_back();
+        return top;
+    }
+
+    // Edge slots of the search tree path from the search source to node
+    EdgePath pathTo(const CompactCityGraph &graph, int source, int node) const
+    {
+        EdgePath path;
+        if (!reached(node))
+        {
+            return path;
+        }
+        path.start = source;
+        for (int v = node; v != source; v = graph.edgeSource(parentEdge[v]))
+        {
+            path.edges.push_back(parentEdge[v]);
+        }
+        reverse(path.edges.begin(), path.edges.end());
+        return path;
+    }
+};
+
+// Answer of one query of a batch
+class RouteResult
+{
+public:
+    double cost = numeric_limits<double>::infinity(); // infinity when there is no path
+    vector<int> path;                                 // node ids, empty when there is no path
+};
+
+// Where the cells of a cost matrix came from, which decides how their paths are built
+enum MatrixSource
+{
+    RouteTableSource, // read from the route table
+    HierarchySource,  // buckets over the contraction hierarchy
+    SearchSource      // one Dijkstra per origin
+};
+
+// Costs of a many-to-many query: one row per origin and one column per destination,
+// stored row-major, infinity where there is no path. Computed with withPaths, it also
+// keeps what CityGraph::matrixPath needs to build the path of a cell when it is asked
+// for; no path is unpacked before that.
+class CostMatrix
+{
+public:
+    size_t rows = 0;
+    size_t columns = 0;
+    vector<double> costs;
+
+    double at(size_t row, size_t column) const { return costs[row * columns + column]; }
+
+    // Filled by costMatrix for matrixPath
+    bool withPaths = false;
+    MatrixSource source = SearchSource;
+    size_t version = 0;                            // graph version the matrix belongs to
+    vector<int> sources;                           // dense index of every origin, -1 when unknown
+    vector<int> targets;                           // dense index of every destination, -1 when unknown
+    vector<vector<pair<int, int>>> searchTrees;    // search: (node, parent edge) on each row's paths, by node
+    vector<int> meeting;                           // hierarchy: meeting node of every cell
+    vector<vector<pair<int, int>>> upwardSpaces;   // hierarchy: (node, parent arc) of each row's search, by node
+    vector<vector<pair<int, int>>> downwardSpaces; // hierarchy: (node, parent arc) of each column's search, by node
+};
+
+// Node ids, adjacency and id index of a snapshot. Successive snapshots share one as
+// long as no node or edge is added, so publishing after a traffic update copies only
+// the cost column.
+class SnapshotTopology
+{
+public:
+    CompactCityGraph graph; // nodeIds, offsets and targets only
+    NodeIndex index;
+
+    SnapshotTopology(const CompactCityGraph &_graph, const NodeIndex &_index) : index(_index)
+    {
+        graph.nodeIds = _graph.nodeIds;
+        graph.offsets = _graph.offsets;
+        graph.targets = _graph.targets;
+    }
+};
+
+// Immutable copy of the graph that reader threads query while the writer keeps
+// changing the live CityGraph. It owns its costs and views the shared topology;
+// the weight and coordinate columns are left empty.
+class GraphSnapshot
+{
+public:
+    size_t version;
+    shared_ptr<SnapshotTopology> topology;
+    CompactCityGraph graph;
+    const NodeIndex &index;
+
+    GraphSnapshot(size_t _version, const shared_ptr<SnapshotTopology> &_topology, const Column<double> &cost)
+        : version(_version), topology(_topology), index(_topology->index)
+    {
+        CompactCityGraph &shared = topology->graph;
+        graph.nodeIds.view(shared.nodeIds.data(), shared.nodeIds.size());
+        graph.offsets.view(shared.offsets.data(), shared.offsets.size());
+        graph.targets.view(shared.targets.data(), shared.targets.size());
+        graph.cost = cost;
+    }
+
+    // Most convenient path as node ids (empty when there is none)
+    vector<int> findBestPath(int start, int end) const
+    {
+        int source = index.find(start);
+        int target = index.find(end);
+        if (source == -1 || target == -1)
+        {
+            return vector<int>();
+        }
+        EdgePath path;
+        graph.shortestPath(source, target, nullptr, nullptr, path);
+        return path.start == -1 ? vector<int>() : graph.nodePath(path);
+    }
+};
+
+// Small ids for the threads that read snapshots, handed back when a thread exits
+class ReaderThreadId
+{
+private:
+    int id;
+
+    static mutex &registryLock()
+    {
+        static mutex lock;
+        return lock;
+    }
+
+    static vector<int> &freeIds()
+    {
+        static vector<int> ids;
+        return ids;
+    }
+
+    static int &nextId()
+    {
+        static int next = 0;
+        return next;
+    }
+
+    ReaderThreadId()
+    {
+        lock_guard<mutex> guard(registryLock());
+        if (freeIds().empty())
+        {
+            id = nextId()++;
+        }
+        else
+        {
+            id = freeIds().back();
+            freeIds().pop_back();
+        }
+    }
+
+    ~ReaderThreadId()
+    {
+        lock_guard<mutex> guard(registryLock());
+        freeIds().push_back(id);
+    }
+
+public:
+    static int get()
+    {
+        thread_local ReaderThreadId holder;
+        return holder.id;
+    }
+};
+
+// Publishes graph snapshots with epoch-based reclamation (a small RCU).
+// A reader announces the global epoch before it loads the current snapshot and
+// withdraws the announcement when it is done: two atomic stores and no lock, so
+// readers never wait for the writer. The writer swaps in a new snapshot, stamps the
+// old one with the epoch of the swap and deletes it once every active reader has
+// announced a later epoch.
+class SnapshotStore
+{
+private:
+    static const int maxReaders = 256;
+    static const uint64_t idle = numeric_limits<uint64_t>::max();
+
+    class alignas(64) ReaderSlot
+    {
+    public:
+        atomic<uint64_t> epoch{idle};
+        int depth = 0; // nested pins, only touched by the owning thread
+    };
+
+    atomic<const GraphSnapshot *> current{nullptr};
+    atomic<uint64_t> globalEpoch{1};
+    ReaderSlot slots[maxReaders];
+    mutex writerLock;
+    vector<pair<uint64_t, const GraphSnapshot *>> retired;
+
+    ReaderSlot &ownSlot()
+    {
+        int id = ReaderThreadId::get();
+        if (id >= maxReaders)
+        {
+            throw runtime_error("too many snapshot reader threads");
+        }
+        return slots[id];
+    }
+
+    // Delete retired snapshots no active reader can still hold; writerLock must be held
+    void reclaim()
+    {
+        uint64_t oldest = idle;
+        for (ReaderSlot &slot : slots)
+        {
+            oldest = min(oldest, slot.epoch.load());
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < retired.size(); ++i)
+        {
+            if (retired[i].first < oldest)
+            {
+                delete retired[i].second;
+            }
+            else
+            {
+                retired[kept++] = retired[i];
+            }
+        }
+        retired.resize(kept);
+    }
+
+public:
+    SnapshotStore() {}
+    SnapshotStore(const SnapshotStore &) = delete;
+    SnapshotStore &operator=(const SnapshotStore &) = delete;
+
+    // Requires that no reader is still active
+    ~SnapshotStore()
+    {
+        delete current.load();
+        for (const auto &entry : retired)
+        {
+            delete entry.second;
+        }
+    }
+
+    const GraphSnapshot *pin()
+    {
+        ReaderSlot &slot = ownSlot();
+        if (slot.depth++ == 0)
+        {
+            slot.epoch.store(globalEpoch.load());
+        }
+        return current.load();
+    }
+
+    void unpin()
+    {
+        ReaderSlot &slot = ownSlot();
+        if (--slot.depth == 0)
+        {
+            slot.epoch.store(idle);
+        }
+    }
+
+    // Make snapshot the current one; the store owns it from now on
+    void publish(const GraphSnapshot *snapshot)
+    {
+        lock_guard<mutex> guard(writerLock);
+        const GraphSnapshot *old = current.exchange(snapshot);
+        uint64_t epoch = globalEpoch.fetch_add(1);
+        if (old)
+        {
+            retired.push_back(make_pair(epoch, old));
+        }
+        reclaim();
+    }
+
+    bool hasSnapshot() const { return current.load() != nullptr; }
+
+    size_t retiredCount()
+    {
+        lock_guard<mutex> guard(writerLock);
+        return retired.size();
+    }
+};
+
+// Keeps the current snapshot pinned for as long as it is alive
+class SnapshotReader
+{
+private:
+    SnapshotStore *store;
+    const GraphSnapshot *snapshot;
+
+public:
+    explicit SnapshotReader(SnapshotStore &_store) : store(&_store), snapshot(_store.pin()) {}
+    SnapshotReader(const SnapshotReader &) = delete;
+    SnapshotReader &operator=(const SnapshotReader &) = delete;
+    SnapshotReader(SnapshotReader &&other) : store(other.store), snapshot(other.snapshot) { other.store = nullptr; }
+    ~SnapshotReader()
+    {
+        if (store)
+        {
+            store->unpin();
+        }
+    }
+
+    // nullptr when nothing was published yet
+    const GraphSnapshot *get() const { return snapshot; }
+    const GraphSnapshot *operator->() const { return snapshot; }
+};
+
+// Single-source shortest path tree over the cached edge costs
+class ShortestPathTree
+{
+public:
+    int source = -1;
+    vector<double> cost;    // infinity when unreachable
+    vector<int> parentEdge; // CSR slot of the tree edge into each node, -1 for the source and unreachable nodes
+    vector<int> parent;     // node at the other end of parentEdge
+    vector<int> order;      // reachable nodes in the order Dijkstra settled them
+
+    void build(const CompactCityGraph &graph, int _source)
+    {
+        source = _source;
+        cost.assign(graph.nodeCount(), numeric_limits<double>::infinity());
+        parentEdge.assign(graph.nodeCount(), -1);
+        parent.assign(graph.nodeCount(), -1);
+        order.clear();
+
+        typedef pair<double, int> QueueEntry;
+        priority_queue<QueueEntry, vector<QueueEntry>, greater<QueueEntry>> queue;
+        cost[source] = 0.0;
+        queue.push(QueueEntry(0.0, source));
+        while (!queue.empty())
+        {
+            QueueEntry top = queue.top();
+            queue.pop();
+            int node = top.second;
+            if (top.first > cost[node])
+            {
+                continue;
+            }
+            order.push_back(node);
+            for (int e = graph.offsets[node]; e < graph.offsets[node + 1]; ++e)
+            {
+                int next = graph.targets[e];
+                double candidate = top.first + graph.edgeCost(e);
+                if (candidate < cost[next])
+                {
+                    cost[next] = candidate;
+                    parentEdge[next] = e;
+                    parent[next] = node;
+                    queue.push(QueueEntry(candidate, next));
+                }
+            }
+        }
+    }
+};
+
+// New traffic / red light values for the edges from source to destination (node ids)
+class EdgeUpdate
+{
+public:
+    int source;
+    int destination;
+    int traffic;
+    int redLight;
+};
+
+// Cost change of one CSR edge slot, as seen by incremental route repair
+class EdgeChange
+{
+public:
+    int edge;
+    double oldCost;
+    double newCost;
+};
+
+// Precomputed all-pairs route table: the cost of the best path between every pair of
+// nodes and the first edge to take, so a query is a lookup plus a walk along next edges.
+// Needs 12 bytes per node pair, so it is meant for city-sized graphs (a few thousand nodes).
+class RouteTable
+{
+public:
+    int nodeCount = 0;
+    size_t version = 0;   // CityGraph version the table was built from
+    vector<double> cost;  // cost[s * nodeCount + t], infinity when unreachable
+    vector<int> nextEdge; // first edge slot of the best s -> t path, -1 when s == t or unreachable
+    vector<int> lastEdge; // last edge slot of that path (row s is the shortest path tree of s)
+
+    bool reachable(int source, int target) const
+    {
+        return cost[size_t(source) * nodeCount + target] != numeric_limits<double>::infinity();
+    }
+
+    // Follow the next edges from source to target
+    EdgePath route(const CompactCityGraph &graph, int source, int target) const
+    {
+        EdgePath path;
+        if (!reachable(source, target))
+        {
+            return path;
+        }
+        path.start = source;
+        for (int node = source; node != target;)
+        {
+            int e = nextEdge[size_t(node) * nodeCount + target];
+            path.edges.push_back(e);
+            node = graph.targets[e];
+        }
+        return path;
+    }
+
+    // O(V^3) Floyd-Warshall, the simplest choice for small cities
+    void buildFloydWarshall(const CompactCityGraph &graph)
+    {
+        int n = nodeCount = graph.nodeCount();
+        cost.assign(size_t(n) * n, numeric_limits<double>::infinity());
+        nextEdge.assign(size_t(n) * n, -1);
+        lastEdge.assign(size_t(n) * n, -1);
+        for (int v = 0; v < n; ++v)
+        {
+            cost[size_t(v) * n + v] = 0.0;
+            for (int e = graph.offsets[v]; e < graph.offsets[v + 1]; ++e)
+            {
+                size_t cell = size_t(v) * n + graph.targets[e];
+                if (graph.edgeCost(e) < cost[cell])
+                {
+                    cost[cell] = graph.edgeCost(e);
+                    nextEdge[cell] = e;
+                    lastEdge[cell] = e;
+                }
+            }
+        }
+        for (int k = 0; k < n; ++k)
+        {
+            const double *throughK = &cost[size_t(k) * n];
+            for (int i = 0; i < n; ++i)
+            {
+                double toK = cost[size_t(i) * n + k];
+                if (toK == numeric_limits<double>::infinity())
+                {
+                    continue;
+                }
+                double *row = &cost[size_t(i) * n];
+                int *nextRow = &nextEdge[size_t(i) * n];
+                int *lastRow = &lastEdge[size_t(i) * n];
+                const int *lastThroughK = &lastEdge[size_t(k) * n];
+                int firstToK = nextRow[k];
+                for (int j = 0; j < n; ++j)
+                {
+                    if (toK + throughK[j] < row[j])
+                    {
+                        row[j] = toK + throughK[j];
+                        nextRow[j] = firstToK;
+                        lastRow[j] = lastThroughK[j];
+                    }
+                }
+            }
+        }
+    }
+
+    // Fill the row of one source from its shortest path tree
+    void fillRow(const ShortestPathTree &tree)
+    {
+        double *row = &cost[size_t(tree.source) * nodeCount];
+        int *nextRow = &nextEdge[size_t(tree.source) * nodeCount];
+        int *lastRow = &lastEdge[size_t(tree.source) * nodeCount];
+        // Parents are settled before their children, so the first edge of a node is
+        // its own tree edge next to the source, or else its parent's first edge
+        for (int node : tree.order)
+        {
+            row[node] = tree.cost[node];
+            lastRow[node] = tree.parentEdge[node];
+            if (node == tree.source)
+            {
+                nextRow[node] = -1;
+            }
+            else
+            {
+                nextRow[node] = tree.parent[node] == tree.source ? tree.parentEdge[node] : nextRow[tree.parent[node]];
+            }
+        }
+    }
+
+    // One Dijkstra per source, spread over the pool
+    void buildDijkstra(const CompactCityGraph &graph, ThreadPool &pool)
+    {
+        int n = nodeCount = graph.nodeCount();
+        cost.assign(size_t(n) * n, numeric_limits<double>::infinity());
+        nextEdge.assign(size_t(n) * n, -1);
+        lastEdge.assign(size_t(n) * n, -1);
+        const int sourcesPerTask = 16;
+        for (int first = 0; first < n; first += sourcesPerTask)
+        {
+            pool.submit([this, &graph, first, n]()
+                        {
+                            ShortestPathTree tree;
+                            for (int source = first; source < min(first + sourcesPerTask, n); ++source)
+                            {
+                                tree.build(graph, source);
+                                fillRow(tree);
+                            }
+                        });
+        }
+        pool.wait();
+    }
+
+    // Scratch space for repairing rows, reused from row to row so a repair only
+    // costs the nodes it touches
+    class RepairWorkspace
+    {
+    public:
+        vector<char> affected;
+        vector<int> marked;
+        vector<int> stack;
+        vector<pair<double, int>> heap;
+    };
+
+    // Repair the shortest path tree of one source after the edge costs in `changes`
+    // moved, in the style of Ramalingam-Reps:
+    //  1. every node below an edge whose cost went up and that was a tree edge loses
+    //     its distance (found by walking tree children, not by scanning the row);
+    //  2. those nodes are re-seeded from their unaffected in-neighbours, and heads of
+    //     edges whose cost went down are seeded when the cheaper edge now wins;
+    //  3. a Dijkstra from the seeds settles only nodes whose distance changed.
+    // graph must already hold the new costs; reverse / forwardSlots give in-edges.
+    void repairRow(const CompactCityGraph &graph, const CompactCityGraph &reverse, const vector<int> &forwardSlots, int source, const vector<EdgeChange> &changes, RepairWorkspace &work)
+    {
+        const double infinity = numeric_limits<double>::infinity();
+        size_t base = size_t(source) * nodeCount;
+        double *dist = &cost[base];
+        int *nextRow = &nextEdge[base];
+        int *lastRow = &lastEdge[base];
+        work.affected.resize(nodeCount, 0);
+        work.marked.clear();
+        work.heap.clear();
+
+        for (const EdgeChange &change : changes)
+        {
+            int head = graph.targets[change.edge];
+            if (change.newCost > change.oldCost && lastRow[head] == change.edge && !work.affected[head])
+            {
+                work.affected[head] = 1;
+                work.marked.push_back(head);
+            }
+        }
+        work.stack = work.marked;
+        while (!work.stack.empty())
+        {
+            int node = work.stack.back();
+            work.stack.pop_back();
+            for (int e = graph.offsets[node]; e < graph.offsets[node + 1]; ++e)
+            {
+                int child = graph.targets[e];
+                if (lastRow[child] == e && !work.affected[child])
+                {
+                    work.affected[child] = 1;
+                    work.marked.push_back(child);
+                    work.stack.push_back(child);
+                }
+            }
+        }
+
+        for (int node : work.marked)
+        {
+            dist[node] = infinity;
+            lastRow[node] = -1;
+            nextRow[node] = -1;
+        }
+        for (int node : work.marked)
+        {
+            for (int r = reverse.offsets[node]; r < reverse.offsets[node + 1]; ++r)
+            {
+                int from = reverse.targets[r];
+                int e = forwardSlots[r];
+                if (!work.affected[from] && dist[from] + graph.edgeCost(e) < dist[node])
+                {
+                    dist[node] = dist[from] + graph.edgeCost(e);
+                    lastRow[node] = e;
+                }
+            }
+            if (dist[node] != infinity)
+            {
+                work.heap.push_back(make_pair(-dist[node], node));
+            }
+        }
+        for (const EdgeChange &change : changes)
+        {
+            int tail = graph.edgeSource(change.edge);
+            int head = graph.targets[change.edge];
+            if (change.newCost < change.oldCost && dist[tail] + change.newCost < dist[head])
+            {
+                dist[head] = dist[tail] + change.newCost;
+                lastRow[head] = change.edge;
+                work.heap.push_back(make_pair(-dist[head], head));
+            }
+        }
+
+        // Max-heap on negated distance
+        make_heap(work.heap.begin(), work.heap.end());
+        while (!work.heap.empty())
+        {
+            pop_heap(work.heap.begin(), work.heap.end());
+            double d = -work.heap.back().first;
+            int node = work.heap.back().second;
+            work.heap.pop_back();
+            if (d > dist[node])
+            {
+                continue;
+            }
+            int parent = graph.edgeSource(lastRow[node]);
+            nextRow[node] = parent == source ? lastRow[node] : nextRow[parent];
+            for (int e = graph.offsets[node]; e < graph.offsets[node + 1]; ++e)
+            {
+                int next = graph.targets[e];
+                if (d + graph.edgeCost(e) < dist[next])
+                {
+                    dist[next] = d + graph.edgeCost(e);
+                    lastRow[next] = e;
+                    work.heap.push_back(make_pair(-dist[next], next));
+                    push_heap(work.heap.begin(), work.heap.end());
+                }
+            }
+        }
+
+        for (int node : work.marked)
+        {
+            work.affected[node] = 0;
+        }
+    }
+
+    // Repair every row, spread over the pool
+    void repair(const CompactCityGraph &graph, const CompactCityGraph &reverse, const vector<int> &forwardSlots, const vector<EdgeChange> &changes, ThreadPool &pool)
+    {
+        const int sourcesPerTask = 64;
+        for (int first = 0; first < nodeCount; first += sourcesPerTask)
+        {
+            pool.submit([this, &graph, &reverse, &forwardSlots, &changes, first]()
+                        {
+                            RepairWorkspace work;
+                            for (int source = first; source < min(first + sourcesPerTask, nodeCount); ++source)
+                            {
+                                repairRow(graph, reverse, forwardSlots, source, changes, work);
+                            }
+                        });
+        }
+        pool.wait();
+    }
+};
+
+// Contraction hierarchy over the convenience cost. Nodes are contracted one at a time,
+// least important first; when removing a node would make a shortest path between two
+// of its neighbours longer, a shortcut arc standing for the two-arc path is added. A
+// query then searches only upward in that order from both ends, settling a few hundred
+// nodes instead of a large part of the graph. Original arcs keep their CSR slot and
+// shortcuts the two arcs they replace, so results unpack to ordinary edge paths.
+class ContractionHierarchy
+{
+public:
+    class Arc
+    {
+    public:
+        int from;
+        int to;
+        double cost;
+        int first;  // shortcut: arc from -> middle, -1 for an original edge
+        int second; // shortcut: arc middle -> to
+        int slot;   // original edge: its CSR slot
+    };
+
+    size_t version = 0; // graph version the hierarchy was built for
+    int nodeCount = 0;
+    vector<int> rank;       // contraction order of every node
+    vector<Arc> arcs;       // original edges (cheapest of parallel ones) and shortcuts
+    vector<int> upOffsets;  // arcs leaving v upward: upArcs[upOffsets[v] .. upOffsets[v + 1] - 1]
+    vector<int> upArcs;
+    vector<int> downOffsets; // arcs entering v from above, searched backward from the target
+    vector<int> downArcs;
+    size_t shortcutCount = 0;
+
+private:
+    // Witness searches are cut short while only estimating a node's priority
+    static const int simulateSettleLimit = 10;
+    static const int applySettleLimit = 1000;
+
+    // Contraction state
+    vector<vector<int>> outArcs;
+    vector<vector<int>> inArcs;
+    vector<char> contracted;
+    vector<char> dominated; // arcs replaced by a cheaper shortcut, left out of the search graphs
+    SearchWorkspace witness;
+    vector<int> level;           // depth of the hierarchy below a node
+    vector<unsigned> targetMark; // == targetStamp for the targets of the current witness search
+    unsigned targetStamp = 0;
+
+    // Local Dijkstra from source avoiding skipped, looking for paths to the marked
+    // targets that make shortcuts through skipped unnecessary. It stops at maxCost,
+    // after settleLimit nodes or once every target is settled; costs are left in witness.
+    void witnessSearch(int source, int skipped, double maxCost, int targets, int settleLimit)
+    {
+        witness.reset(nodeCount);
+        witness.relax(source, 0.0, -1);
+        int settled = 0;
+        while (!witness.heap.empty() && settled < settleLimit && targets > 0)
+        {
+            pair<double, int> top = witness.pop();
+            if (top.first > witness.cost[top.second])
+            {
+                continue;
+            }
+            if (top.first > maxCost)
+            {
+                break;
+            }
+            ++settled;
+            targets -= targetMark[top.second] == targetStamp;
+            for (int a : outArcs[top.second])
+            {
+                int next = arcs[a].to;
+                double candidate = top.first + arcs[a].cost;
+                if (next != skipped && !contracted[next] && candidate < witness.costOf(next))
+                {
+                    witness.relax(next, candidate, -1);
+                }
+            }
+        }
+    }
+
+    static void removeArc(vector<int> &list, int arc)
+    {
+        for (size_t k = 0; k < list.size(); ++k)
+        {
+            if (list[k] == arc)
+            {
+                list[k] = list.back();
+                list.pop_back();
+                return;
+            }
+        }
+    }
+
+    // Shortcuts needed to contract v; added to the graph when apply is set
+    int contract(int v, bool apply)
+    {
+        int shortcuts = 0;
+        for (size_t i = 0; i < inArcs[v].size(); ++i)
+        {
+            const Arc in = arcs[inArcs[v][i]];
+            if (contracted[in.from])
+            {
+                continue;
+            }
+            double maxCost = 0.0;
+            int targets = 0;
+            ++targetStamp;
+            for (int b : outArcs[v])
+            {
+                if (!contracted[arcs[b].to] && arcs[b].to != in.from)
+                {
+                    maxCost = max(maxCost, in.cost + arcs[b].cost);
+                    targets += targetMark[arcs[b].to] != targetStamp;
+                    targetMark[arcs[b].to] = targetStamp;
+                }
+            }
+            if (targets == 0)
+            {
+                continue;
+            }
+            witnessSearch(in.from, v, maxCost, targets, apply ? applySettleLimit : simulateSettleLimit);
+            for (size_t j = 0; j < outArcs[v].size(); ++j)
+            {
+                const Arc out = arcs[outArcs[v][j]];
+                if (contracted[out.to] || out.to == in.from)
+                {
+                    continue;
+                }
+                double via = in.cost + out.cost;
+                if (witness.costOf(out.to) <= via)
+                {
+                    continue;
+                }
+                // An arc between the same nodes is replaced when it is dearer
+                vector<int> &fromArcs = outArcs[in.from];
+                size_t parallel = 0;
+                while (parallel < fromArcs.size() && arcs[fromArcs[parallel]].to != out.to)
+                {
+                    ++parallel;
+                }
+                if (parallel < fromArcs.size() && arcs[fromArcs[parallel]].cost <= via)
+                {
+                    continue;
+                }
+                ++shortcuts;
+                if (apply)
+                {
+                    if (parallel < fromArcs.size())
+                    {
+                        dominated[fromArcs[parallel]] = 1;
+                        removeArc(inArcs[out.to], fromArcs[parallel]);
+                        fromArcs[parallel] = fromArcs.back();
+                        fromArcs.pop_back();
+                    }
+                    Arc shortcut = {in.from, out.to, via, inArcs[v][i], outArcs[v][j], -1};
+                    arcs.push_back(shortcut);
+                    dominated.push_back(0);
+                    fromArcs.push_back(arcs.size() - 1);
+                    inArcs[out.to].push_back(arcs.size() - 1);
+                    ++shortcutCount;
+                }
+            }
+        }
+        return shortcuts;
+    }
+
+    int priority(int v, const vector<int> &contractedNeighbours)
+    {
+        int degree = 0;
+        for (int a : inArcs[v])
+        {
+            degree += !contracted[arcs[a].from];
+        }
+        for (int a : outArcs[v])
+        {
+            degree += !contracted[arcs[a].to];
+        }
+        return 2 * (contract(v, false) - degree) + contractedNeighbours[v] + level[v];
+    }
+
+public:
+    explicit ContractionHierarchy(const CompactCityGraph &graph)
+    {
+        nodeCount = graph.nodeCount();
+        outArcs.assign(nodeCount, vector<int>());
+        inArcs.assign(nodeCount, vector<int>());
+        contracted.assign(nodeCount, 0);
+        targetMark.assign(nodeCount, 0);
+
+        // Original edges, keeping only the cheapest of parallel ones and no loops
+        vector<int> arcTo(nodeCount, -1);
+        for (int v = 0; v < nodeCount; ++v)
+        {
+            for (int e = graph.offsets[v]; e < graph.offsets[v + 1]; ++e)
+            {
+                int w = graph.targets[e];
+                if (w == v)
+                {
+                    continue;
+                }
+                if (arcTo[w] != -1 && arcs[arcTo[w]].from == v)
+                {
+                    if (graph.edgeCost(e) < arcs[arcTo[w]].cost)
+                    {
+                        arcs[arcTo[w]].cost = graph.edgeCost(e);
+                        arcs[arcTo[w]].slot = e;
+                    }
+                    continue;
+                }
+                Arc arc = {v, w, graph.edgeCost(e), -1, -1, e};
+                arcTo[w] = arcs.size();
+                arcs.push_back(arc);
+                dominated.push_back(0);
+                outArcs[v].push_back(arcTo[w]);
+                inArcs[w].push_back(arcTo[w]);
+            }
+        }
+
+        // Contract by lazily updated priority: a popped node whose priority went up is
+        // put back unless it is still the smallest
+        vector<int> contractedNeighbours(nodeCount, 0);
+        level.assign(nodeCount, 0);
+        vector<int> current(nodeCount);
+        priority_queue<pair<int, int>, vector<pair<int, int>>, greater<pair<int, int>>> queue;
+        for (int v = 0; v < nodeCount; ++v)
+        {
+            current[v] = priority(v, contractedNeighbours);
+            queue.push(make_pair(current[v], v));
+        }
+        rank.assign(nodeCount, -1);
+        int nextRank = 0;
+        while (!queue.empty())
+        {
+            pair<int, int> top = queue.top();
+            queue.pop();
+            int v = top.second;
+            if (contracted[v] || top.first != current[v])
+            {
+                continue;
+            }
+            current[v] = priority(v, contractedNeighbours);
+            if (!queue.empty() && current[v] > queue.top().first)
+            {
+                queue.push(make_pair(current[v], v));
+                continue;
+            }
+            contract(v, true);
+            contracted[v] = 1;
+            rank[v] = nextRank++;
+
+            // The remaining graph no longer needs v's arcs
+            vector<int> neighbours;
+            for (int a : inArcs[v])
+            {
+                neighbours.push_back(arcs[a].from);
+                removeArc(outArcs[arcs[a].from], a);
+            }
+            for (int a : outArcs[v])
+            {
+                neighbours.push_back(arcs[a].to);
+                removeArc(inArcs[arcs[a].to], a);
+            }
+            sort(neighbours.begin(), neighbours.end());
+            neighbours.erase(unique(neighbours.begin(), neighbours.end()), neighbours.end());
+            for (int u : neighbours)
+            {
+                if (!contracted[u])
+                {
+                    ++contractedNeighbours[u];
+                    level[u] = max(level[u], level[v] + 1);
+                    current[u] = priority(u, contractedNeighbours);
+                    queue.push(make_pair(current[u], u));
+                }
+            }
+        }
+
+        // Search graphs: upward arcs by tail, downward arcs by head
+        upOffsets.assign(nodeCount + 1, 0);
+        downOffsets.assign(nodeCount + 1, 0);
+        for (size_t a = 0; a < arcs.size(); ++a)
+        {
+            if (dominated[a])
+            {
+                continue;
+            }
+            if (rank[arcs[a].to] > rank[arcs[a].from])
+            {
+                ++upOffsets[arcs[a].from + 1];
+            }
+            else
+            {
+                ++downOffsets[arcs[a].to + 1];
+            }
+        }
+        for (int v = 0; v < nodeCount; ++v)
+        {
+            upOffsets[v + 1] += upOffsets[v];
+            downOffsets[v + 1] += downOffsets[v];
+        }
+        upArcs.resize(upOffsets[nodeCount]);
+        downArcs.resize(downOffsets[nodeCount]);
+        vector<int> upFill(upOffsets.begin(), upOffsets.end() - 1);
+        vector<int> downFill(downOffsets.begin(), downOffsets.end() - 1);
+        for (size_t a = 0; a < arcs.size(); ++a)
+        {
+            if (dominated[a])
+            {
+                continue;
+            }
+            if (rank[arcs[a].to] > rank[arcs[a].from])
+            {
+                upArcs[upFill[arcs[a].from]++] = a;
+            }
+            else
+            {
+                downArcs[downFill[arcs[a].to]++] = a;
+            }
+        }
+
+        vector<vector<int>>().swap(outArcs);
+        vector<vector<int>>().swap(inArcs);
+        vector<char>().swap(contracted);
+        vector<char>().swap(dominated);
+        vector<unsigned>().swap(targetMark);
+        vector<int>().swap(level);
+    }
+
+    // Cheapest path from source to target as CSR edge slots (start == -1 when there is
+    // none); forward and backward are the two searches' working state
+    double query(int source, int target, SearchWorkspace &forward, SearchWorkspace &backward, EdgePath &path) const
+    {
+        path = EdgePath();
+        forward.reset(nodeCount);
+        backward.reset(nodeCount);
+        forward.relax(source, 0.0, -1);
+        backward.relax(target, 0.0, -1);
+        double best = numeric_limits<double>::infinity();
+        int meeting = -1;
+
+        while (true)
+        {
+            double forwardMin = forward.heap.empty() ? numeric_limits<double>::infinity() : forward.heap.front().first;
+            double backwardMin = backward.heap.empty() ? numeric_limits<double>::infinity() : backward.heap.front().first;
+            bool goForward = forwardMin <= backwardMin;
+            if (min(forwardMin, backwardMin) >= best)
+            {
+                break;
+            }
+            SearchWorkspace &work = goForward ? forward : backward;
+            const SearchWorkspace &other = goForward ? backward : forward;
+            pair<double, int> top = work.pop();
+            int v = top.second;
+            if (top.first > work.cost[v])
+            {
+                continue;
+            }
+            if (other.reached(v) && top.first + other.cost[v] < best)
+            {
+                best = top.first + other.cost[v];
+                meeting = v;
+            }
+            const vector<int> &offsets = goForward ? upOffsets : downOffsets;
+            const vector<int> &searchArcs = goForward ? upArcs : downArcs;
+
+            // Stall on demand: a node that is reached more cheaply through a higher
+            // neighbour is not on a shortest up-down path, so its arcs are not expanded
+            const vector<int> &otherOffsets = goForward ? downOffsets : upOffsets;
+            const vector<int> &otherArcs = goForward ? downArcs : upArcs;
+            bool stalled = false;
+            for (int i = otherOffsets[v]; i < otherOffsets[v + 1] && !stalled; ++i)
+            {
+                const Arc &arc = arcs[otherArcs[i]];
+                stalled = work.costOf(goForward ? arc.from : arc.to) + arc.cost < top.first;
+            }
+            if (stalled)
+            {
+                continue;
+            }
+            for (int i = offsets[v]; i < offsets[v + 1]; ++i)
+            {
+                const Arc &arc = arcs[searchArcs[i]];
+                int next = goForward ? arc.to : arc.from;
+                double candidate = top.first + arc.cost;
+                if (candidate < work.costOf(next))
+                {
+                    work.relax(next, candidate, searchArcs[i]);
+                }
+            }
+        }
+        if (meeting == -1)
+        {
+            return best;
+        }
+
+        vector<int> upward;
+        for (int v = meeting; v != source; v = arcs[forward.parentEdge[v]].from)
+        {
+            upward.push_back(forward.parentEdge[v]);
+        }
+        path.start = source;
+        for (size_t i = upward.size(); i-- > 0;)
+        {
+            unpack(upward[i], path.edges);
+        }
+        for (int v = meeting; v != target; v = arcs[backward.parentEdge[v]].to)
+        {
+            unpack(backward.parentEdge[v], path.edges);
+        }
+        return best;
+    }
+
+    // Append the original CSR edge slots an arc stands for
+    void unpack(int arc, vector<int> &slots) const
+    {
+        vector<int> pending(1, arc);
+        while (!pending.empty())
+        {
+            const Arc &a = arcs[pending.back()];
+            pending.pop_back();
+            if (a.first == -1)
+            {
+                slots.push_back(a.slot);
+            }
+            else
+            {
+                pending.push_back(a.second);
+                pending.push_back(a.first);
+            }
+        }
+    }
+
+    // One-directional upward search from v without a target: forward over upward arcs,
+    // or backward (towards v) over downward arcs, stalled on demand like query.
+    // visit(node, cost) is called for every settled node that is not stalled; the
+    // parentEdge of work then holds the arc each such node was reached through.
+    void upwardSearch(int v, bool forward, SearchWorkspace &work, const function<void(int, double)> &visit) const
+    {
+        const vector<int> &offsets = forward ? upOffsets : downOffsets;
+        const vector<int> &searchArcs = forward ? upArcs : downArcs;
+        const vector<int> &otherOffsets = forward ? downOffsets : upOffsets;
+        const vector<int> &otherArcs = forward ? downArcs : upArcs;
+        work.reset(nodeCount);
+        work.relax(v, 0.0, -1);
+        while (!work.heap.empty())
+        {
+            pair<double, int> top = work.pop();
+            int u = top.second;
+            if (top.first > work.cost[u])
+            {
+                continue;
+            }
+            bool stalled = false;
+            for (int i = otherOffsets[u]; i < otherOffsets[u + 1] && !stalled; ++i)
+            {
+                const Arc &arc = arcs[otherArcs[i]];
+                stalled = work.costOf(forward ? arc.from : arc.to) + arc.cost < top.first;
+            }
+            if (stalled)
+            {
+                continue;
+            }
+            visit(u, top.first);
+            for (int i = offsets[u]; i < offsets[u + 1]; ++i)
+            {
+                const Arc &arc = arcs[searchArcs[i]];
+                int next = forward ? arc.to : arc.from;
+                double candidate = top.first + arc.cost;
+                if (candidate < work.costOf(next))
+                {
+                    work.relax(next, candidate, searchArcs[i]);
+                }
+            }
+        }
+    }
+
+    // Bytes held by the index
+    size_t memoryBytes() const
+    {
+        return arcs.capacity() * sizeof(Arc) + (rank.capacity() + upOffsets.capacity() + upArcs.capacity() + downOffsets.capacity() + downArcs.capacity()) * sizeof(int);
+    }
+};
+
+// Landmark distances for A* lower bounds (ALT). For a landmark L the triangle
+// inequality gives d(v, t) >= d(L, t) - d(L, v) and d(v, t) >= d(v, L) - d(t, L)
+// for any non-negative edge costs, so the bounds need no geometry at all.
+class LandmarkIndex
+{
+public:
+    static const int activeLandmarks = 4; // landmarks consulted by one query
+
+    size_t version = 0; // graph version the distances were computed for
+    int nodeCount = 0;
+    vector<int> landmarks;       // dense indices
+    vector<double> fromLandmark; // d(L_i, v) at v * landmarks.size() + i, infinity when unreachable
+    vector<double> toLandmark;   // d(v, L_i), same layout
+
+    // Landmarks are picked one by one as the node farthest from those picked so far
+    LandmarkIndex(const CompactCityGraph &graph, int count)
+    {
+        nodeCount = graph.nodeCount();
+        count = min(count, nodeCount);
+        CompactCityGraph reverse = graph.reversed();
+        vector<vector<double>> from;
+        vector<vector<double>> to;
+        vector<double> nearest(nodeCount, numeric_limits<double>::infinity());
+        vector<char> picked(nodeCount, 0);
+        ShortestPathTree tree;
+        if (count > 0)
+        {
+            tree.build(graph, 0);
+            landmarks.push_back(tree.order.back());
+        }
+        while (int(from.size()) < count)
+        {
+            int landmark = landmarks.back();
+            picked[landmark] = 1;
+            tree.build(graph, landmark);
+            from.push_back(tree.cost);
+            tree.build(reverse, landmark);
+            to.push_back(tree.cost);
+            if (int(landmarks.size()) == count)
+            {
+                break;
+            }
+            int farthest = -1;
+            for (int v = 0; v < nodeCount; ++v)
+            {
+                nearest[v] = min(nearest[v], from.back()[v]);
+                if (!picked[v] && (farthest == -1 || nearest[v] > nearest[farthest]))
+                {
+                    farthest = v;
+                }
+            }
+            landmarks.push_back(farthest);
+        }
+
+        // Node-major, so the bounds of one node share a cache line
+        fromLandmark.resize(size_t(nodeCount) * count);
+        toLandmark.resize(size_t(nodeCount) * count);
+        for (int v = 0; v < nodeCount; ++v)
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                fromLandmark[size_t(v) * count + i] = from[i][v];
+                toLandmark[size_t(v) * count + i] = to[i][v];
+            }
+        }
+    }
+
+    // Lower bound on d(v, w) from the landmarks listed in active; infinity when the
+    // distances prove that v cannot reach w
+    double lowerBound(int v, int w, const int *active, int activeCount) const
+    {
+        size_t k = landmarks.size();
+        const double *fromV = fromLandmark.data() + v * k;
+        const double *fromW = fromLandmark.data() + w * k;
+        const double *toV = toLandmark.data() + v * k;
+        const double *toW = toLandmark.data() + w * k;
+        double bound = 0.0;
+        for (int i = 0; i < activeCount; ++i)
+        {
+            int l = active[i];
+            // inf - inf is NaN and fails both comparisons: that landmark says nothing
+            double viaFrom = fromW[l] - fromV[l];
+            double viaTo = toV[l] - toW[l];
+            if (viaFrom > bound)
+            {
+                bound = viaFrom;
+            }
+            if (viaTo > bound)
+            {
+                bound = viaTo;
+            }
+        }
+        return bound;
+    }
+
+    // The landmarks giving the best bound for source -> target; returns how many
+    int selectActive(int source, int target, int *active) const
+    {
+        vector<pair<double, int>> ranked;
+        for (int i = 0; i < int(landmarks.size()); ++i)
+        {
+            ranked.push_back(make_pair(-lowerBound(source, target, &i, 1), i));
+        }
+        int count = min(int(ranked.size()), int(activeLandmarks));
+        partial_sort(ranked.begin(), ranked.begin() + count, ranked.end());
+        for (int i = 0; i < count; ++i)
+        {
+            active[i] = ranked[i].second;
+        }
+        return count;
+    }
+
+    // Bytes held by the index
+    size_t memoryBytes() const
+    {
+        return (fromLandmark.capacity() + toLandmark.capacity()) * sizeof(double) + landmarks.capacity() * sizeof(int);
+    }
+};
+
+// Which nodes can reach which, from the strongly connected components (SCCs) of the
+// graph. Components are numbered by Tarjan's algorithm, sinks first. Up to
+// maxClosureComponents components the index keeps the transitive closure of the
+// condensation as one bitset row per component and answers exactly. Above that, two
+// interval labels per component (GRAIL) reject most unreachable pairs: if v reaches w,
+// then w's interval lies inside v's.
+class ReachabilityIndex
+{
+public:
+    static const int maxClosureComponents = 16384; // closure of at most 32 MB
+    static const int labelings = 2;
+
+    vector<int> component; // of every node
+    int componentCount = 0;
+    int words = 0;                 // closure row length
+    vector<uint64_t> closure;      // components reached by each component, itself included
+    vector<int> rank[labelings];   // post-order number of a component
+    vector<int> lowest[labelings]; // smallest rank it reaches
+
+    void build(const CompactCityGraph &graph)
+    {
+        int n = graph.nodeCount();
+        componentCount = tarjan(graph, false, component);
+        closure.clear();
+        words = 0;
+        for (int k = 0; k < labelings; ++k)
+        {
+            rank[k].clear();
+            lowest[k].clear();
+        }
+
+        // Nodes grouped by component, so the condensation edges of a component can be
+        // listed; successors always have smaller numbers
+        vector<int> first(componentCount + 1, 0);
+        for (int v = 0; v < n; ++v)
+        {
+            ++first[component[v] + 1];
+        }
+        for (int c = 0; c < componentCount; ++c)
+        {
+            first[c + 1] += first[c];
+        }
+        vector<int> members(n);
+        vector<int> fill(first.begin(), first.end() - 1);
+        for (int v = 0; v < n; ++v)
+        {
+            members[fill[component[v]]++] = v;
+        }
+        auto forEachSuccessor = [&](int c, const function<void(int)> &visit)
+        {
+            for (int i = first[c]; i < first[c + 1]; ++i)
+            {
+                int v = members[i];
+                for (int e = graph.offsets[v]; e < graph.offsets[v + 1]; ++e)
+                {
+                    if (component[graph.targets[e]] != c)
+                    {
+                        visit(component[graph.targets[e]]);
+                    }
+                }
+            }
+        };
+
+        if (componentCount <= maxClosureComponents)
+        {
+            words = (componentCount + 63) / 64;
+            closure.assign(size_t(componentCount) * words, 0);
+            for (int c = 0; c < componentCount; ++c)
+            {
+                uint64_t *row = closure.data() + size_t(c) * words;
+                row[c >> 6] |= uint64_t(1) << (c & 63);
+                forEachSuccessor(c, [&](int d)
+                                 {
+                                     const uint64_t *reached = closure.data() + size_t(d) * words;
+                                     for (int w = 0; w < words; ++w)
+                                     {
+                                         row[w] |= reached[w];
+                                     }
+                                 });
+            }
+            return;
+        }
+
+        // The component numbers are one post-order; a second DFS that takes roots and
+        // edges in reverse order gives another, which cuts the pairs the first misses
+        vector<int> otherComponent;
+        tarjan(graph, true, otherComponent);
+        rank[0].resize(componentCount);
+        rank[1].resize(componentCount);
+        vector<int> byRank(componentCount);
+        for (int c = 0; c < componentCount; ++c)
+        {
+            rank[0][c] = c;
+        }
+        for (int v = 0; v < n; ++v)
+        {
+            rank[1][component[v]] = otherComponent[v];
+        }
+        for (int k = 0; k < labelings; ++k)
+        {
+            for (int c = 0; c < componentCount; ++c)
+            {
+                byRank[rank[k][c]] = c;
+            }
+            lowest[k].assign(componentCount, 0);
+            for (int r = 0; r < componentCount; ++r)
+            {
+                int c = byRank[r];
+                int low = r;
+                forEachSuccessor(c, [&](int d)
+                                 { low = min(low, lowest[k][d]); });
+                lowest[k][c] = low;
+            }
+        }
+    }
+
+    // False only when no path leads from node source to node target; exact (true
+    // exactly when a path exists) while the closure is kept
+    bool mayReach(int source, int target) const
+    {
+        return component[source] == component[target] || componentMayReach(component[source], component[target]);
+    }
+
+    bool exact() const
+    {
+        return words > 0 || componentCount == 0;
+    }
+
+    // Account for a new edge between two indexed nodes. Returns false when the index
+    // has to be rebuilt: the edge closes a cycle across components (they merge), or,
+    // for the labels, the target's interval does not lie inside the source's.
+    bool addEdge(int source, int target)
+    {
+        int from = component[source];
+        int to = component[target];
+        if (from == to || componentMayReach(from, to))
+        {
+            return true; // no pair becomes reachable that the index did not allow already
+        }
+        if (!exact() || componentMayReach(to, from))
+        {
+            return false;
+        }
+        // Everything that reaches the source now also reaches what the target reaches
+        const uint64_t *reached = closure.data() + size_t(to) * words;
+        for (int c = 0; c < componentCount; ++c)
+        {
+            uint64_t *row = closure.data() + size_t(c) * words;
+            if (row[from >> 6] >> (from & 63) & 1)
+            {
+                for (int w = 0; w < words; ++w)
+                {
+                    row[w] |= reached[w];
+                }
+            }
+        }
+        return true;
+    }
+
+    // Bytes held by the index
+    size_t memoryBytes() const
+    {
+        size_t bytes = component.capacity() * sizeof(int) + closure.capacity() * sizeof(uint64_t);
+        for (int k = 0; k < labelings; ++k)
+        {
+            bytes += (rank[k].capacity() + lowest[k].capacity()) * sizeof(int);
+        }
+        return bytes;
+    }
+
+private:
+    bool componentMayReach(int from, int to) const
+    {
+        if (exact())
+        {
+            return closure[size_t(from) * words + (to >> 6)] >> (to & 63) & 1;
+        }
+        for (int k = 0; k < labelings; ++k)
+        {
+            if (lowest[k][to] < lowest[k][from] || rank[k][to] > rank[k][from])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Iterative Tarjan; numbers the components in the order they are completed (so
+    // every edge leads to an equal or smaller number) and returns their count.
+    // backwards visits roots and out-edges in reverse order.
+    static int tarjan(const CompactCityGraph &graph, bool backwards, vector<int> &component)
+    {
+        int n = graph.nodeCount();
+        vector<int> order(n, -1);
+        vector<int> low(n, 0);
+        vector<int> open;              // nodes of unfinished components
+        vector<pair<int, int>> frames; // DFS stack: node, edges left to scan
+        component.assign(n, -1);
+        int counter = 0;
+        int count = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            int root = backwards ? n - 1 - i : i;
+            if (order[root] != -1)
+            {
+                continue;
+            }
+            order[root] = low[root] = counter++;
+            open.push_back(root);
+            frames.push_back(make_pair(root, graph.offsets[root + 1] - graph.offsets[root]));
+            while (!frames.empty())
+            {
+                int v = frames.back().first;
+                int &left = frames.back().second;
+                if (left > 0)
+                {
+                    --left;
+                    int e = backwards ? graph.offsets[v] + left : graph.offsets[v + 1] - 1 - left;
+                    int w = graph.targets[e];
+                    if (order[w] == -1)
+                    {
+                        order[w] = low[w] = counter++;
+                        open.push_back(w);
+                        frames.push_back(make_pair(w, graph.offsets[w + 1] - graph.offsets[w]));
+                    }
+                    else if (component[w] == -1)
+                    {
+                        low[v] = min(low[v], order[w]); // w is still open
+                    }
+                    continue;
+                }
+                frames.pop_back();
+                if (!frames.empty())
+                {
+                    int parent = frames.back().first;
+                    low[parent] = min(low[parent], low[v]);
+                }
+                if (low[v] == order[v])
+                {
+                    int w;
+                    do
+                    {
+                        w = open.back();
+                        open.pop_back();
+                        component[w] = count;
+                    } while (w != v);
+                    ++count;
+                }
+            }
+        }
+        return count;
+    }
+};
+
+// One scheduled hop of a trip: leaves node from at departure and reaches node to at
+// arrival (dense indices, seconds after midnight of the service day)
+class Connection
+{
+public:
+    int from;
+    int to;
+    int departure;
+    int arrival;
+    int trip;
+};
+
+// Time-independent walk between two stops, taken when changing vehicles
+class Footpath
+{
+public:
+    int to;
+    int seconds;
+};
+
+// Part of a journey: a ride on one trip, or a walk (trip == -1)
+class JourneyLeg
+{
+public:
+    int trip;
+    int from; // node ids
+    int to;
+    int departure;
+    int arrival;
+};
+
+// Answer of an earliest-arrival query
+class Journey
+{
+public:
+    int arrival = -1; // -1 when the target cannot be reached that day
+    vector<JourneyLeg> legs;
+    size_t connectionsScanned = 0;
+};
+
+// Scheduled layer of the network, queried with the Connection Scan Algorithm: all
+// connections of the day sorted by departure are scanned once, in order, from the
+// first one leaving after the query time. A connection is usable when its trip was
+// already boarded or its stop is reached by then, so a query is a single pass over a
+// flat array with no priority queue.
+class Timetable
+{
+public:
+    int tripCount = 0;
+
+    // Next trip number for addConnection
+    int addTrip() { return tripCount++; }
+
+    // Connections of one trip must be added in the order the trip runs
+    void addConnection(const Connection &connection)
+    {
+        connections.push_back(connection);
+        sorted = false;
+    }
+
+    void addFootpath(int from, int to, int seconds)
+    {
+        footpathList.push_back(make_pair(from, Footpath{to, seconds}));
+        sorted = false;
+    }
+
+    size_t connectionCount() const { return connections.size(); }
+    size_t footpathCount() const { return footpathList.size(); }
+
+    // Sort the connections and index the footpaths; done by the first query after a change
+    void prepare(int nodeCount)
+    {
+        if (sorted && int(footpathOffsets.size()) == nodeCount + 1)
+        {
+            return;
+        }
+        // Ties by arrival, so a zero-length hop into a stop comes before the departures it
+        // feeds; stable, so the zero-length hops of one trip keep their running order
+        stable_sort(connections.begin(), connections.end(), [](const Connection &a, const Connection &b)
+                    { return a.departure != b.departure ? a.departure < b.departure : a.arrival < b.arrival; });
+        footpathOffsets.assign(nodeCount + 1, 0);
+        for (const auto &footpath : footpathList)
+        {
+            ++footpathOffsets[footpath.first + 1];
+        }
+        for (int v = 0; v < nodeCount; ++v)
+        {
+            footpathOffsets[v + 1] += footpathOffsets[v];
+        }
+        footpaths.resize(footpathList.size());
+        vector<int> fill(footpathOffsets.begin(), footpathOffsets.end() - 1);
+        for (const auto &footpath : footpathList)
+        {
+            footpaths[fill[footpath.first]++] = footpath.second;
+        }
+        sorted = true;
+    }
+
+    // Earliest arrival at target when leaving source at departure. Footpaths are walked
+    // once per change (from the stop a vehicle arrives at, or from source) and are not
+    // chained, as with GTFS transfers. Legs use dense indices until CityGraph maps them.
+    Journey earliestArrival(int source, int target, int departure, int nodeCount)
+    {
+        prepare(nodeCount);
+        Journey journey;
+        startQuery(nodeCount);
+        const int never = numeric_limits<int>::max();
+        ride(source, departure, -1, -1);
+
+        // Connections leaving at the same second are scanned again while a zero-length
+        // hop reaches a stop at that second, since it may feed one scanned before it
+        size_t c = lower_bound(connections.begin(), connections.end(), departure, [](const Connection &connection, int time)
+                               { return connection.departure < time; }) -
+                   connections.begin();
+        while (c < connections.size() && connections[c].departure < arrivalAt(target))
+        {
+            size_t groupEnd = c;
+            while (groupEnd < connections.size() && connections[groupEnd].departure == connections[c].departure)
+            {
+                ++groupEnd;
+            }
+            bool again = true;
+            while (again)
+            {
+                again = false;
+                for (size_t i = c; i < groupEnd; ++i)
+                {
+                    ++journey.connectionsScanned;
+                    again |= scan(i);
+                }
+            }
+            c = groupEnd;
+        }
+        if (arrivalAt(target) == never)
+        {
+            return journey;
+        }
+
+        // Follow the labels back from the target: a walk always starts where a ride ended
+        journey.arrival = arrivalAt(target);
+        for (int v = target; v != source;)
+        {
+            if (walkedFrom[v] != -1)
+            {
+                journey.legs.push_back(JourneyLeg{-1, walkedFrom[v], v, arrival[v] - walkSeconds[v], arrival[v]});
+                v = walkedFrom[v];
+                if (v == source)
+                {
+                    break;
+                }
+            }
+            const Connection &enter = connections[enterConnection[v]];
+            const Connection &exit = connections[exitConnection[v]];
+            journey.legs.push_back(JourneyLeg{exit.trip, enter.from, v, enter.departure, exit.arrival});
+            v = enter.from;
+        }
+        reverse(journey.legs.begin(), journey.legs.end());
+        return journey;
+    }
+
+    // Bytes held by the timetable
+    size_t memoryBytes() const
+    {
+        return connections.capacity() * sizeof(Connection) + footpathList.capacity() * sizeof(pair<int, Footpath>) + footpaths.capacity() * sizeof(Footpath) + footpathOffsets.capacity() * sizeof(int);
+    }
+
+private:
+    vector<Connection> connections; // by departure once prepared
+    vector<pair<int, Footpath>> footpathList;
+    vector<Footpath> footpaths; // grouped by origin: footpathOffsets[v] .. footpathOffsets[v + 1] - 1
+    vector<int> footpathOffsets;
+    bool sorted = false;
+
+    // Query labels, valid where the stamp equals generation. A node has two: the
+    // earliest arrival by any means, and the earliest arrival by vehicle (or the
+    // departure at the source), which is where walks start.
+    uint32_t generation = 0;
+    vector<uint32_t> nodeStamp;
+    vector<int> arrival;
+    vector<int> walkedFrom; // -1 unless arrival is a walk from that node
+    vector<int> walkSeconds;
+    vector<int> rideArrival;
+    vector<int> enterConnection; // ride that gave rideArrival: where it was boarded ...
+    vector<int> exitConnection;  // ... and its last hop
+    vector<uint32_t> tripStamp;
+    vector<int> boardedAt; // connection where a trip was boarded
+
+    void startQuery(int nodeCount)
+    {
+        if (int(nodeStamp.size()) != nodeCount)
+        {
+            nodeStamp.assign(nodeCount, 0);
+            arrival.resize(nodeCount);
+            walkedFrom.resize(nodeCount);
+            walkSeconds.resize(nodeCount);
+            rideArrival.resize(nodeCount);
+            enterConnection.resize(nodeCount);
+            exitConnection.resize(nodeCount);
+            generation = 0;
+            tripStamp.clear();
+        }
+        if (int(tripStamp.size()) != tripCount)
+        {
+            tripStamp.assign(tripCount, 0);
+            boardedAt.resize(tripCount);
+            fill(nodeStamp.begin(), nodeStamp.end(), 0);
+            generation = 0;
+        }
+        if (++generation == 0)
+        {
+            fill(nodeStamp.begin(), nodeStamp.end(), 0);
+            fill(tripStamp.begin(), tripStamp.end(), 0);
+            generation = 1;
+        }
+    }
+
+    int arrivalAt(int node) const
+    {
+        return nodeStamp[node] == generation ? arrival[node] : numeric_limits<int>::max();
+    }
+
+    int rideArrivalAt(int node) const
+    {
+        return nodeStamp[node] == generation ? rideArrival[node] : numeric_limits<int>::max();
+    }
+
+    void touch(int node)
+    {
+        if (nodeStamp[node] != generation)
+        {
+            nodeStamp[node] = generation;
+            arrival[node] = numeric_limits<int>::max();
+            rideArrival[node] = numeric_limits<int>::max();
+        }
+    }
+
+    // Take connection i if its trip is boarded or can be boarded; returns true when it
+    // reached a stop right at its departure time. A rescan may board a trip at an
+    // earlier connection than before, never ride one backwards.
+    bool scan(size_t i)
+    {
+        const Connection &c = connections[i];
+        if (tripStamp[c.trip] != generation || int(i) < boardedAt[c.trip])
+        {
+            if (arrivalAt(c.from) > c.departure)
+            {
+                return false;
+            }
+            tripStamp[c.trip] = generation;
+            boardedAt[c.trip] = int(i);
+        }
+        if (c.arrival >= rideArrivalAt(c.to))
+        {
+            return false;
+        }
+        ride(c.to, c.arrival, boardedAt[c.trip], int(i));
+        return c.arrival == c.departure;
+    }
+
+    // A vehicle (enter .. exit) reaches node at time; then walk on from there
+    void ride(int node, int time, int enter, int exit)
+    {
+        touch(node);
+        rideArrival[node] = time;
+        enterConnection[node] = enter;
+        exitConnection[node] = exit;
+        if (time < arrival[node])
+        {
+            arrival[node] = time;
+            walkedFrom[node] = -1;
+        }
+        for (int i = footpathOffsets[node]; i < footpathOffsets[node + 1]; ++i)
+        {
+            const Footpath &footpath = footpaths[i];
+            touch(footpath.to);
+            if (time + footpath.seconds < arrival[footpath.to])
+            {
+                arrival[footpath.to] = time + footpath.seconds;
+                walkedFrom[footpath.to] = node;
+                walkSeconds[footpath.to] = footpath.seconds;
+            }
+        }
+    }
+};
+
+// Key of a cached best-path result. The graph version is part of the key, so a
+// result computed before a change can never be served afterwards.
+class RouteKey
+{
+public:
+    int start;
+    int end;
+    size_t version;
+
+    bool operator==(const RouteKey &other) const
+    {
+        return start == other.start && end == other.end && version == other.version;
+    }
+};
+
+class RouteKeyHash
+{
+public:
+    size_t operator()(const RouteKey &key) const
+    {
+        uint64_t h = (uint64_t(uint32_t(key.start)) << 32 | uint32_t(key.end)) ^ (uint64_t(key.version) * 0x9e3779b97f4a7c15ull);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        return h;
+    }
+};
+
+class CachedRoute
+{
+public:
+    EdgePath path; // start == -1 when there is no path
+    double cost = numeric_limits<double>::infinity();
+};
+
+class RouteCacheStats
+{
+public:
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t entries = 0;
+};
+
+// Bounded LRU cache of best-path results, safe to use from many threads.
+// Keys are spread over independently locked shards, each with its own LRU list,
+// so concurrent queries rarely contend on the same lock.
+class RouteCache
+{
+private:
+    static const int shardCount = 16;
+
+    class Shard
+    {
+    public:
+        mutex lock;
+        list<pair<RouteKey, CachedRoute>> entries; // most recently used first
+        unordered_map<RouteKey, list<pair<RouteKey, CachedRoute>>::iterator, RouteKeyHash> index;
+    };
+
+    Shard shards[shardCount];
+    size_t shardCapacity;
+    atomic<size_t> hits{0};
+    atomic<size_t> misses{0};
+    atomic<size_t> evictions{0};
+
+    Shard &shardFor(const RouteKey &key)
+    {
+        return shards[RouteKeyHash()(key) >> 7 & (shardCount - 1)];
+    }
+
+public:
+    explicit RouteCache(size_t capacity = 4096) { setCapacity(capacity); }
+
+    // Total number of entries kept (rounded up to a multiple of the shard count)
+    void setCapacity(size_t capacity)
+    {
+        shardCapacity = max<size_t>(1, (capacity + shardCount - 1) / shardCount);
+        for (Shard &shard : shards)
+        {
+            lock_guard<mutex> guard(shard.lock);
+            while (shard.entries.size() > shardCapacity)
+            {
+                shard.index.erase(shard.entries.back().first);
+                shard.entries.pop_back();
+                ++evictions;
+            }
+        }
+    }
+
+    bool lookup(const RouteKey &key, CachedRoute &route)
+    {
+        Shard &shard = shardFor(key);
+        lock_guard<mutex> guard(shard.lock);
+        auto found = shard.index.find(key);
+        if (found == shard.index.end())
+        {
+            ++misses;
+            return false;
+        }
+        shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+        route = found->second->second;
+        ++hits;
+        return true;
+    }
+
+    void insert(const RouteKey &key, const CachedRoute &route)
+    {
+        Shard &shard = shardFor(key);
+        lock_guard<mutex> guard(shard.lock);
+        auto found = shard.index.find(key);
+        if (found != shard.index.end())
+        {
+            found->second->second = route;
+            shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+            return;
+        }
+        shard.entries.push_front(make_pair(key, route));
+        shard.index[key] = shard.entries.begin();
+        if (shard.entries.size() > shardCapacity)
+        {
+            shard.index.erase(shard.entries.back().first);
+            shard.entries.pop_back();
+            ++evictions;
+        }
+    }
+
+    void clear()
+    {
+        for (Shard &shard : shards)
+        {
+            lock_guard<mutex> guard(shard.lock);
+            shard.entries.clear();
+            shard.index.clear();
+        }
+    }
+
+    RouteCacheStats stats()
+    {
+        RouteCacheStats result;
+        result.hits = hits;
+        result.misses = misses;
+        result.evictions = evictions;
+        for (Shard &shard : shards)
+        {
+            lock_guard<mutex> guard(shard.lock);
+            result.entries += shard.entries.size();
+        }
+        return result;
+    }
+};
+
+// Outcome of a bulk import
+class ImportStats
+{
+public:
+    size_t rowsRead = 0; // data rows, without header and blank lines
+    size_t rowsImported = 0;
+    size_t rowsRejected = 0;
+    size_t nodesAdded = 0;
+    size_t edgesAdded = 0;
+    size_t connectionsAdded = 0;
+    double seconds = 0.0;
+    vector<string> errors; // "file:line: reason" for the first rejected rows
+
+    static const size_t maxErrors = 20;
+
+    double rowsPerSecond() const { return seconds > 0.0 ? rowsRead / seconds : 0.0; }
+
+    void reject(const string &path, size_t line, const char *reason)
+    {
+        ++rowsRejected;
+        if (errors.size() < maxErrors)
+        {
+            errors.push_back(path + ":" + to_string(line) + ": " + reason);
+        }
+    }
+};
+
+// Text file read in chunks of whole lines, so every chunk can be parsed on its own.
+// Only the current chunk and the start of the next line are held in memory.
+class ChunkedFile
+{
+private:
+    ifstream in;
+    string carry; // start of a line that did not fit in the last chunk
+
+public:
+    static const size_t chunkBytes = 4 * 1024 * 1024;
+
+    explicit ChunkedFile(const string &path) : in(path, ios::binary)
+    {
+        if (!in)
+        {
+            throw runtime_error("cannot open " + path);
+        }
+    }
+
+    // Next run of whole lines (at the end of the file the last line may lack its line
+    // break); false when the file is exhausted
+    bool next(string &chunk)
+    {
+        chunk.swap(carry);
+        carry.clear();
+        while (in)
+        {
+            size_t old = chunk.size();
+            chunk.resize(old + chunkBytes);
+            in.read(&chunk[old], chunkBytes);
+            chunk.resize(old + in.gcount());
+            size_t lastBreak = chunk.rfind('\n');
+            if (lastBreak != string::npos)
+            {
+                carry.assign(chunk, lastBreak + 1, string::npos);
+                chunk.resize(lastBreak + 1);
+                return true;
+            }
+        }
+        return !chunk.empty();
+    }
+};
+
+typedef pair<const char *, const char *> CsvField;
+
+// Split one CSV line into fields. Quoted fields may hold commas; their enclosing
+// quotes are dropped. Returns false on an unterminated quote.
+bool splitCsvLine(const char *begin, const char *end, vector<CsvField> &fields)
+{
+    fields.clear();
+    if (end > begin && end[-1] == '\r')
+    {
+        --end;
+    }
+    const char *p = begin;
+    while (true)
+    {
+        if (p < end && *p == '"')
+        {
+            const char *start = ++p;
+            while (p < end && !(*p == '"' && (p + 1 == end || p[1] != '"')))
+            {
+                p += *p == '"' ? 2 : 1;
+            }
+            if (p >= end)
+            {
+                return false;
+            }
+            fields.push_back(CsvField(start, p));
+            ++p;
+            while (p < end && *p != ',')
+            {
+                ++p;
+            }
+        }
+        else
+        {
+            const char *start = p;
+            while (p < end && *p != ',')
+            {
+                ++p;
+            }
+            fields.push_back(CsvField(start, p));
+        }
+        if (p >= end)
+        {
+            return true;
+        }
+        ++p; // the comma
+    }
+}
+
+// Whole-field integer, surrounding blanks allowed
+bool parseCsvInt(const CsvField &field, int &value)
+{
+    const char *p = field.first;
+    const char *end = field.second;
+    while (p < end && *p == ' ')
+    {
+        ++p;
+    }
+    while (end > p && end[-1] == ' ')
+    {
+        --end;
+    }
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        ++p;
+    }
+    if (p == end)
+    {
+        return false;
+    }
+    long long result = 0;
+    for (; p < end; ++p)
+    {
+        if (*p < '0' || *p > '9')
+        {
+            return false;
+        }
+        result = result * 10 + (*p - '0');
+        if (result > numeric_limits<int>::max())
+        {
+            return false;
+        }
+    }
+    value = int(negative ? -result : result);
+    return true;
+}
+
+string csvText(const CsvField &field)
+{
+    return string(field.first, field.second);
+}
+
+// GTFS time "H:MM:SS" (hours may pass 24) in seconds; an empty field gives -1
+bool parseGtfsTime(const CsvField &field, int &seconds)
+{
+    if (field.first == field.second)
+    {
+        seconds = -1;
+        return true;
+    }
+    int parts[3] = {0, 0, 0};
+    int part = 0;
+    bool digits = false;
+    for (const char *p = field.first; p < field.second; ++p)
+    {
+        if (*p == ':' && part < 2 && digits)
+        {
+            ++part;
+            digits = false;
+        }
+        else if (*p >= '0' && *p <= '9' && parts[part] < 100000)
+        {
+            parts[part] = parts[part] * 10 + (*p - '0');
+            digits = true;
+        }
+        else if (*p != ' ')
+        {
+            return false;
+        }
+    }
+    if (part != 2 || !digits || parts[1] >= 60 || parts[2] >= 60)
+    {
+        return false;
+    }
+    seconds = parts[0] * 3600 + parts[1] * 60 + parts[2];
+    return true;
+}
+
+// Index of a named column in a CSV header, or -1
+int csvColumn(const vector<CsvField> &header, const char *name)
+{
+    for (size_t i = 0; i < header.size(); ++i)
+    {
+        if (csvText(header[i]) == name)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Whether a CSV line is exactly the header with these column names, in this order
+bool isCsvHeader(const vector<CsvField> &fields, const vector<const char *> &names)
+{
+    if (fields.size() != names.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        if (csvText(fields[i]) != names[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// One chunk of a CSV file after parsing; lines are counted from the chunk start
+template <class Row>
+class ParsedChunk
+{
+public:
+    vector<Row> rows;
+    vector<int> rowLines;
+    vector<pair<int, const char *>> rejected; // (line, reason)
+    int lineCount = 0;
+    int blankLines = 0;
+};
+
+// Stream a CSV file through parse and apply. Chunks are parsed in parallel on the pool
+// while the next ones are read; apply runs on the calling thread in file order, so it
+// may change the graph. At most two rounds of chunks are held in memory.
+// isHeader(fields) decides whether the first line is a header. parse(fields, row) and
+// apply(row) return nullptr for a good row, or the reason it is rejected. skipped() is
+// called in file order, between the apply calls, for every row parse rejected.
+template <class Row, class Header, class Parse, class Apply, class Skip>
+ImportStats importCsv(const string &path, ThreadPool &pool, Header isHeader, Parse parse, Apply apply, Skip skipped)
+{
+    auto start = chrono::steady_clock::now();
+    ImportStats stats;
+    ChunkedFile file(path);
+    const size_t chunksPerRound = 2 * pool.size();
+    size_t lineBase = 1; // file line of the first line of the next chunk
+
+    auto readRound = [&file, chunksPerRound](vector<string> &chunks)
+    {
+        chunks.clear();
+        string chunk;
+        while (chunks.size() < chunksPerRound && file.next(chunk))
+        {
+            chunks.push_back(chunk);
+        }
+    };
+
+    vector<string> current;
+    vector<string> next;
+    readRound(current);
+    if (!current.empty())
+    {
+        // Header only on the first line of the file
+        string &first = current[0];
+        size_t lineEnd = first.find('\n');
+        const char *begin = first.data();
+        const char *end = begin + (lineEnd == string::npos ? first.size() : lineEnd);
+        vector<CsvField> fields;
+        if (splitCsvLine(begin, end, fields) && isHeader(fields))
+        {
+            first.erase(0, lineEnd == string::npos ? first.size() : lineEnd + 1);
+            ++lineBase;
+        }
+    }
+
+    while (!current.empty())
+    {
+        vector<ParsedChunk<Row>> parsed(current.size());
+        for (size_t c = 0; c < current.size(); ++c)
+        {
+            pool.submit([&current, &parsed, &parse, c]()
+                        {
+                            const string &text = current[c];
+                            ParsedChunk<Row> &out = parsed[c];
+                            vector<CsvField> fields;
+                            const char *p = text.data();
+                            const char *end = p + text.size();
+                            while (p < end)
+                            {
+                                const char *lineEnd = static_cast<const char *>(memchr(p, '\n', end - p));
+                                if (!lineEnd)
+                                {
+                                    lineEnd = end;
+                                }
+                                int line = out.lineCount++;
+                                if (lineEnd == p || (lineEnd == p + 1 && *p == '\r'))
+                                {
+                                    ++out.blankLines;
+                                }
+                                else
+                                {
+                                    Row row;
+                                    const char *reason = splitCsvLine(p, lineEnd, fields) ? parse(fields, row) : "unterminated quote";
+                                    if (reason)
+                                    {
+                                        out.rejected.push_back(make_pair(line, reason));
+                                    }
+                                    else
+                                    {
+                                        out.rows.push_back(row);
+                                        out.rowLines.push_back(line);
+                                    }
+                                }
+                                p = lineEnd + 1;
+                            }
+                        });
+        }
+        readRound(next);
+        pool.wait();
+
+        for (ParsedChunk<Row> &chunk : parsed)
+        {
+            // Rows and rejections are merged back into file order
+            size_t r = 0;
+            for (size_t i = 0; i <= chunk.rejected.size(); ++i)
+            {
+                int limit = i < chunk.rejected.size() ? chunk.rejected[i].first : chunk.lineCount;
+                for (; r < chunk.rows.size() && chunk.rowLines[r] < limit; ++r)
+                {
+                    const char *reason = apply(chunk.rows[r]);
+                    if (reason)
+                    {
+                        stats.reject(path, lineBase + chunk.rowLines[r], reason);
+                    }
+                    else
+                    {
+                        ++stats.rowsImported;
+                    }
+                }
+                if (i < chunk.rejected.size())
+                {
+                    skipped();
+                    stats.reject(path, lineBase + chunk.rejected[i].first, chunk.rejected[i].second);
+                }
+            }
+            stats.rowsRead += chunk.lineCount - chunk.blankLines;
+            lineBase += chunk.lineCount;
+        }
+        current.swap(next);
+    }
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+template <class Row, class Header, class Parse, class Apply>
+ImportStats importCsv(const string &path, ThreadPool &pool, Header isHeader, Parse parse, Apply apply)
+{
+    return importCsv<Row>(path, pool, isHeader, parse, apply, []() {});
+}
+
+enum AllPairsMethod
+{
+    AutoAllPairs,     // Floyd-Warshall for small cities, parallel Dijkstra otherwise
+    FloydWarshall,
+    ParallelDijkstra
+};
+
+enum PruningMode
+{
+    NoPruning,        // plain enumeration of every path within the limits
+    IncumbentPruning, // cut a branch once its cost reaches the best complete path
+    LowerBoundPruning // also add an exact lower bound on the cost still to go
+};
+
+// Lower bounds steering findBestPathAStar; a bound that is not available counts as zero
+enum HeuristicMode
+{
+    NoHeuristic,        // bidirectional Dijkstra
+    GeometricHeuristic, // straight-line distance, when every node has coordinates
+    LandmarkHeuristic,  // ALT bounds, after precomputeLandmarks
+    CombinedHeuristic   // the larger of the two
+};
+
+// Edge weight an isochrone is measured in
+enum CostMetric
+{
+    ConvenienceMetric, // the per-edge convenience cost, as in findBestPath
+    DistanceMetric     // EdgeInfo::distance
+};
+
+// Vehicles a rider can use in a multimodal query
+enum TravelMode
+{
+    BusMode,
+    TaxiMode,
+    AutoMode,
+    TravelModeCount
+};
+
+const char *const travelModeNames[TravelModeCount] = {"Bus", "Taxi", "Auto"};
+
+// Rules of a multimodal query. A mode can only be taken (at the start, or by changing
+// vehicles on the way) at a node whose type offers it, for that type's penalty; the
+// edge costs of a mode are its convenience costs scaled by costFactor.
+class ModeProfile
+{
+public:
+    double costFactor[TravelModeCount] = {1.0, 1.0, 1.0};
+
+    // Bus at bus stops, taxis at taxi stands, autos at auto stands
+    explicit ModeProfile(double changePenalty = 0.5)
+    {
+        allowBoarding("Bus Stop", BusMode, changePenalty);
+        allowBoarding("Taxi Stand", TaxiMode, changePenalty);
+        allowBoarding("Auto Stand", AutoMode, changePenalty);
+    }
+
+    void allowBoarding(const string &nodeType, TravelMode mode, double penalty)
+    {
+        if (penalty < 0.0)
+        {
+            throw logic_error("allowBoarding: negative penalty");
+        }
+        boarding[nodeType].penalty[mode] = penalty;
+    }
+
+    void forbidBoarding(const string &nodeType, TravelMode mode)
+    {
+        boarding[nodeType].penalty[mode] = numeric_limits<double>::infinity();
+    }
+
+    // Cost of taking mode at a node of the given type; infinity when it is not offered
+    double boardingPenalty(const string &nodeType, TravelMode mode) const
+    {
+        auto rule = boarding.find(nodeType);
+        return rule == boarding.end() ? numeric_limits<double>::infinity() : rule->second.penalty[mode];
+    }
+
+private:
+    class Boarding
+    {
+    public:
+        double penalty[TravelModeCount] = {numeric_limits<double>::infinity(), numeric_limits<double>::infinity(), numeric_limits<double>::infinity()};
+    };
+    unordered_map<string, Boarding> boarding;
+};
+
+// Answer of a multimodal query
+class MultimodalRoute
+{
+public:
+    double cost = numeric_limits<double>::infinity(); // infinity when there is no route
+    vector<int> path;             // node ids
+    vector<TravelMode> edgeModes; // mode used on each edge of path
+};
+
+// Limits for the branch-and-bound search; negative / infinite means unlimited
+class SearchLimits
+{
+public:
+    int maxHops = -1;
+    double maxScore = numeric_limits<double>::infinity();
+    PruningMode pruning = LowerBoundPruning;
+};
+
+class CityGraph
+{
+
+private:
+    GraphArena arena;      // owns every node and edge below; freed in one go with the graph
+    set<string> nodeTypes; // interned node type names that CityNode::type points into
+    vector<CityNode *> city;
+    NodeIndex nodeIndex;
+    CompactCityGraph compactGraph;
+    bool compactDirty = true;
+    size_t version = 0; // bumped by every change to the graph
+    unique_ptr<RouteTable> routeTable;
+    unique_ptr<ContractionHierarchy> hierarchy;
+    unique_ptr<LandmarkIndex> landmarks;
+    ReachabilityIndex reachability; // patched by addEdge, rebuilt after other changes
+    bool reachabilityDirty = true;
+    SearchWorkspace forwardSearch;  // shared by hierarchy and A* queries
+    SearchWorkspace backwardSearch;
+    size_t geometryVersion = numeric_limits<size_t>::max(); // version maxEdgeLength/minEdgeCost belong to
+    double maxEdgeLength = 0.0; // longest straight-line edge, 0 when coordinates are unusable
+    double minEdgeCost = 0.0;   // cheapest edge cost
+    SearchWorkspace modeSearch; // multimodal queries, over (node, mode) states
+    SearchWorkspace isochroneSearch;
+    size_t typeIdsVersion = numeric_limits<size_t>::max();
+    vector<int> typeIds;               // dense type id of every node
+    vector<const char *> typeIdNames;  // type name of every id
+    RouteCache routeCache;
+    Timetable timetable; // scheduled services, on dense node indices
+    CompactCityGraph reverseGraph; // topology only: its weight columns go stale on updates
+    vector<int> reverseSlots;      // reversed edge -> forward CSR slot
+    bool reverseDirty = true;
+    mutable SnapshotStore snapshots;
+    bool nodesPending = false;          // loaded from a file: city is only built when needed
+    Column<int> fileTypeIds;            // node types of a loaded graph, into fileTypeNames
+    vector<const char *> fileTypeNames; // interned in nodeTypes
+    shared_ptr<SnapshotTopology> snapshotTopology; // shared by snapshots until the next change
+
+    // Called after every change: drops everything derived from the old graph
+    void markChanged()
+    {
+        compactDirty = true;
+        reverseDirty = true;
+        ++version;
+        routeTable.reset();
+        hierarchy.reset();
+        landmarks.reset();
+        reachabilityDirty = true;
+        snapshotTopology.reset();
+    }
+
+    // In-edges of every node, for the repair of route tables
+    const CompactCityGraph &reverseTopology()
+    {
+        if (reverseDirty)
+        {
+            reverseGraph = compact().reversed(&reverseSlots);
+            reverseDirty = false;
+        }
+        return reverseGraph;
+    }
+
+    // Helper function to find a node by ID
+    CityNode *findNode(int nodeId)
+    {
+        PROFILE_HOT_SCOPE("findNode");
+        materializeNodes();
+        int index = nodeIndex.find(nodeId);
+        return index == -1 ? nullptr : city[index];
+    }
+
+    // A graph loaded from a file answers queries straight from the mapped CSR; the
+    // CityNode/CityEdge objects are created from it the first time something needs
+    // them (edits, traffic updates, display). The CSR itself stays as it is.
+    void materializeNodes()
+    {
+        if (!nodesPending)
+        {
+            return;
+        }
+        nodesPending = false;
+        const CompactCityGraph &graph = compactGraph;
+        city.reserve(graph.nodeCount());
+        for (int v = 0; v < graph.nodeCount(); ++v)
+        {
+            CityNode *node = arena.create<CityNode>(graph.nodeIds[v], fileTypeNames[fileTypeIds[v]], &arena, graph.x[v], graph.y[v]);
+            node->index = v;
+            city.push_back(node);
+        }
+        for (int v = 0; v < graph.nodeCount(); ++v)
+        {
+            city[v]->edges.reserve(graph.offsets[v + 1] - graph.offsets[v]);
+            for (int e = graph.offsets[v]; e < graph.offsets[v + 1]; ++e)
+            {
+                EdgeInfo info(graph.distance[e], graph.traffic[e], graph.redLight[e]);
+                city[v]->edges.push_back(arena.create<CityEdge>(city[v], city[graph.targets[e]], info));
+            }
+        }
+        fileTypeIds = Column<int>();
+    }
+
+    // Coordinates bound the cost still to go only through the number of edges: the
+    // convenience cost of an edge falls as it gets longer, so a straight-line distance D
+    // says nothing about the distance term, but it needs at least ceil(D / maxEdgeLength)
+    // edges of at least minEdgeCost each. Usable once every node has coordinates.
+    void refreshGeometry()
+    {
+        if (geometryVersion == version)
+        {
+            return;
+        }
+        geometryVersion = version;
+        const CompactCityGraph &graph = compact();
+        maxEdgeLength = 0.0;
+        minEdgeCost = numeric_limits<double>::infinity();
+        for (int v = 0; v < graph.nodeCount(); ++v)
+        {
+            if (std::isnan(graph.x[v]) || std::isnan(graph.y[v]))
+            {
+                maxEdgeLength = 0.0;
+                return;
+            }
+            for (int e = graph.offsets[v]; e < graph.offsets[v + 1]; ++e)
+            {
+                int w = graph.targets[e];
+                maxEdgeLength = max(maxEdgeLength, hypot(graph.x[w] - graph.x[v], graph.y[w] - graph.y[v]));
+                minEdgeCost = min(minEdgeCost, graph.cost[e]);
+            }
+        }
+    }
+
+    const char *nodeType(int index) const
+    {
+        return nodesPending ? fileTypeNames[fileTypeIds[index]] : city[index]->type;
+    }
+
+    // Dense id of the type of every node, for per-type tables in searches; typeIdNames
+    // holds the type of each id
+    const vector<int> &nodeTypeIds()
+    {
+        if (typeIdsVersion != version)
+        {
+            typeIdsVersion = version;
+            int n = compact().nodeCount();
+            typeIds.resize(n);
+            typeIdNames.clear();
+            unordered_map<const char *, int> ids; // type names are interned
+            for (int v = 0; v < n; ++v)
+            {
+                auto found = ids.insert(make_pair(nodeType(v), int(ids.size())));
+                if (found.second)
+                {
+                    typeIdNames.push_back(found.first->first);
+                }
+                typeIds[v] = found.first->second;
+            }
+        }
+        return typeIds;
+    }
+
+    // Rebuild the CSR form after the graph was modified
+    const CompactCityGraph &compact()
+    {
+        if (compactDirty)
+        {
+            compactGraph = CompactCityGraph(city);
+            compactDirty = false;
+        }
+        return compactGraph;
+    }
+
+    // DFS over the CSR graph; currentEdges holds the edge slots of the current path and
+    // currentCost their summed cost. Returns false once the visitor asked to stop.
+    bool forEachPathHelper(const CompactCityGraph &graph, int start, int currentNode, int endNode, vector<int> &currentEdges, double currentCost, vector<char> &visitedNodes, const PathVisitor &visitor)
+    {
+        if (currentNode == endNode)
+        {
+            // Found a path, hand it to the visitor
+            PROFILE_COUNT(PathsFoundCounter, 1);
+            PathView path = {&graph, start, currentEdges.data(), currentEdges.size(), currentCost};
+            return visitor(path);
+        }
+
+        PROFILE_COUNT(NodesExpandedCounter, 1);
+        visitedNodes[currentNode] = 1;
+        bool keepGoing = true;
+        // Continue DFS for unvisited neighbors
+        for (int e = graph.offsets[currentNode]; e < graph.offsets[currentNode + 1] && keepGoing; ++e)
+        {
+            if (!visitedNodes[graph.targets[e]])
+            {
+                PROFILE_COUNT(EdgesRelaxedCounter, 1);
+                currentEdges.push_back(e);
+                keepGoing = forEachPathHelper(graph, start, graph.targets[e], endNode, currentEdges, currentCost + graph.edgeCost(e), visitedNodes, visitor);
+                currentEdges.pop_back();
+            }
+        }
+        visitedNodes[currentNode] = 0;
+        return keepGoing;
+    }
+
+    // Sequential DFS of one enumeration subtree with a bitset of visited nodes
+    static void enumerateSubtree(const CompactCityGraph &graph, int start, int currentNode, int endNode, vector<int> &currentEdges, vector<uint64_t> &visited, PathBatch &foundPaths)
+    {
+        if (currentNode == endNode)
+        {
+            foundPaths.add(start, currentEdges);
+            return;
+        }
+        visited[currentNode >> 6] |= uint64_t(1) << (currentNode & 63);
+        for (int e = graph.offsets[currentNode]; e < graph.offsets[currentNode + 1]; ++e)
+        {
+            int next = graph.targets[e];
+            if (!(visited[next >> 6] >> (next & 63) & 1))
+            {
+                currentEdges.push_back(e);
+                enumerateSubtree(graph, start, next, endNode, currentEdges, visited, foundPaths);
+                currentEdges.pop_back();
+            }
+        }
+        visited[currentNode >> 6] &= ~(uint64_t(1) << (currentNode & 63));
+    }
+
+    // One work-stealing task: a path prefix ending at currentNode with its own visited set.
+    // While the pool is short of queued work the task splits into one task per unvisited
+    // neighbour; otherwise it finishes its subtree sequentially.
+    static void enumerateTask(const CompactCityGraph &graph, ThreadPool &pool, int start, int currentNode, int endNode, vector<int> currentEdges, vector<uint64_t> visited, vector<PathBatch> &results)
+    {
+        PathBatch &foundPaths = results[pool.workerIndex()];
+        const size_t maxSplitDepth = 16;
+        if (currentNode == endNode || currentEdges.size() >= maxSplitDepth || pool.queuedTasks() >= size_t(4 * pool.size()))
+        {
+            enumerateSubtree(graph, start, currentNode, endNode, currentEdges, visited, foundPaths);
+            return;
+        }
+
+        visited[currentNode >> 6] |= uint64_t(1) << (currentNode & 63);
+        for (int e = graph.offsets[currentNode]; e < graph.offsets[currentNode + 1]; ++e)
+        {
+            int next = graph.targets[e];
+            if (!(visited[next >> 6] >> (next & 63) & 1))
+            {
+                vector<int> childEdges = currentEdges;
+                childEdges.push_back(e);
+                pool.submit([&graph, &pool, start, next, endNode, childEdges, visited, &results]()
+                            { enumerateTask(graph, pool, start, next, endNode, childEdges, visited, results); });
+            }
+        }
+    }
+
+    // One single-source search for the queries order[first .. last - 1], which all
+    // start at the same node; stops as soon as every destination is settled
+    void solveGroup(const CompactCityGraph &graph, const pair<int, int> *queries, const vector<pair<int, int>> &order, size_t first, size_t last, SearchWorkspace &work, vector<RouteResult> &results)
+    {
+        PROFILE_HOT_SCOPE("solveGroup");
+        int source = order[first].first;
+        vector<int> destinations;
+        for (size_t i = first; i < last; ++i)
+        {
+            destinations.push_back(nodeIndex.find(queries[order[i].second].second));
+        }
+        sort(destinations.begin(), destinations.end());
+        destinations.erase(unique(destinations.begin(), destinations.end()), destinations.end());
+
+        work.reset(graph.nodeCount());
+        work.relax(source, 0.0, -1);
+        size_t remaining = destinations.size();
+        while (!work.heap.empty() && remaining > 0)
+        {
+            pair<double, int> top = work.pop();
+            int node = top.second;
+            if (top.first > work.cost[node])
+            {
+                continue;
+            }
+            PROFILE_COUNT(NodesExpandedCounter, 1);
+            if (binary_search(destinations.begin(), destinations.end(), node))
+            {
+                --remaining;
+            }
+            for (int e = graph.offsets[node]; e < graph.offsets[node + 1]; ++e)
+            {
+                double candidate = top.first + graph.edgeCost(e);
+                if (candidate < work.costOf(graph.targets[e]))
+                {
+                    PROFILE_COUNT(EdgesRelaxedCounter, 1);
+                    work.relax(graph.targets[e], candidate, e);
+                }
+            }
+        }
+
+        for (size_t i = first; i < last; ++i)
+        {
+            int query = order[i].second;
+            EdgePath path = work.pathTo(graph, source, nodeIndex.find(queries[query].second));
+            if (path.start != -1)
+            {
+                results[query].cost = work.cost[nodeIndex.find(queries[query].second)];
+                results[query].path = graph.nodePath(path);
+            }
+        }
+    }
+
+    // Cost matrix by one Dijkstra per origin, origins spread over the pool. A search
+    // stops once every destination the reachability index allows is settled. With paths,
+    // each row keeps the parent edges of the nodes on its paths: their union is a tree,
+    // far smaller than the paths written out one by one.
+    void searchMatrix(const vector<int> &sources, const vector<int> &targets, bool withPaths, ThreadPool &pool, CostMatrix &matrix)
+    {
+        const CompactCityGraph &graph = compact();
+        const ReachabilityIndex &reach = reachabilityIndex();
+        vector<int> uniqueTargets;
+        for (int t : targets)
+        {
+            if (t != -1)
+            {
+                uniqueTargets.push_back(t);
+            }
+        }
+        sort(uniqueTargets.begin(), uniqueTargets.end());
+        uniqueTargets.erase(unique(uniqueTargets.begin(), uniqueTargets.end()), uniqueTargets.end());
+
+        vector<SearchWorkspace> workspaces(pool.size());
+        vector<vector<char>> onTree(withPaths ? pool.size() : 0);
+        for (size_t row = 0; row < sources.size(); ++row)
+        {
+            int source = sources[row];
+            if (source == -1)
+            {
+                continue;
+            }
+            pool.submit([&, row, source]()
+                        {
+                            SearchWorkspace &work = workspaces[pool.workerIndex()];
+                            size_t remaining = 0;
+                            for (int t : uniqueTargets)
+                            {
+                                remaining += reach.mayReach(source, t);
+                            }
+                            work.reset(graph.nodeCount());
+                            work.relax(source, 0.0, -1);
+                            while (!work.heap.empty() && remaining > 0)
+                            {
+                                pair<double, int> top = work.pop();
+                                int node = top.second;
+                                if (top.first > work.cost[node])
+                                {
+                                    continue;
+                                }
+                                if (binary_search(uniqueTargets.begin(), uniqueTargets.end(), node))
+                                {
+                                    --remaining;
+                                }
+                                for (int e = graph.offsets[node]; e < graph.offsets[node + 1]; ++e)
+                                {
+                                    double candidate = top.first + graph.edgeCost(e);
+                                    if (candidate < work.costOf(graph.targets[e]))
+                                    {
+                                        work.relax(graph.targets[e], candidate, e);
+                                    }
+                                }
+                            }
+                            for (size_t column = 0; column < targets.size(); ++column)
+                            {
+                                if (targets[column] == -1 || !work.reached(targets[column]))
+                                {
+                                    continue;
+                                }
+                                matrix.costs[row * targets.size() + column] = work.cost[targets[column]];
+                            }
+                            if (!withPaths)
+                            {
+                                return;
+                            }
+                            vector<char> &marked = onTree[pool.workerIndex()];
+                            marked.resize(graph.nodeCount(), 0);
+                            vector<pair<int, int>> &tree = matrix.searchTrees[row];
+                            for (int target : targets)
+                            {
+                                if (target == -1 || !work.reached(target))
+                                {
+                                    continue;
+                                }
+                                for (int v = target; v != source && !marked[v]; v = graph.edgeSource(work.parentEdge[v]))
+                                {
+                                    marked[v] = 1;
+                                    tree.push_back(make_pair(v, work.parentEdge[v]));
+                                }
+                            }
+                            for (const pair<int, int> &entry : tree)
+                            {
+                                marked[entry.first] = 0;
+                            }
+                            sort(tree.begin(), tree.end());
+                        });
+        }
+        pool.wait();
+    }
+
+    // Cost matrix over the contraction hierarchy (bucket many-to-many). A backward
+    // upward search from every destination leaves (column, cost) entries in a bucket
+    // at each node it settles; a forward upward search from every origin then scans
+    // the buckets of its own nodes, and the cheapest sum is the cost of the cell. Each
+    // search only covers a few hundred nodes, so a 1000 x 1000 matrix costs about two
+    // thousand small searches instead of a million queries. With paths, the meeting node
+    // of every cell and both search spaces are kept for matrixPath.
+    void hierarchyMatrix(const vector<int> &sources, const vector<int> &targets, bool withPaths, ThreadPool &pool, CostMatrix &matrix)
+    {
+        class SpaceEntry
+        {
+        public:
+            int node;
+            double cost;
+            int parentArc;
+
+            bool operator<(const SpaceEntry &other) const { return node < other.node; }
+        };
+        const ContractionHierarchy &ch = *hierarchy;
+        const CompactCityGraph &graph = compact();
+        vector<SearchWorkspace> workspaces(pool.size());
+
+        // Backward search spaces, sorted by node
+        vector<vector<SpaceEntry>> spaces(targets.size());
+        for (size_t column = 0; column < targets.size(); ++column)
+        {
+            if (targets[column] == -1)
+            {
+                continue;
+            }
+            pool.submit([&, column]()
+                        {
+                            SearchWorkspace &work = workspaces[pool.workerIndex()];
+                            vector<SpaceEntry> &space = spaces[column];
+                            ch.upwardSearch(targets[column], false, work, [&](int v, double cost)
+                                            {
+                                                SpaceEntry entry = {v, cost, work.parentEdge[v]};
+                                                space.push_back(entry);
+                                            });
+                            sort(space.begin(), space.end());
+                        });
+        }
+        pool.wait();
+
+        // Buckets: the (column, cost) entries of every node, in CSR form
+        vector<int> bucketOffsets(graph.nodeCount() + 1, 0);
+        for (const auto &space : spaces)
+        {
+            for (const SpaceEntry &entry : space)
+            {
+                ++bucketOffsets[entry.node + 1];
+            }
+        }
+        for (int v = 0; v < graph.nodeCount(); ++v)
+        {
+            bucketOffsets[v + 1] += bucketOffsets[v];
+        }
+        vector<pair<int, double>> buckets(bucketOffsets.back());
+        vector<int> fill(bucketOffsets.begin(), bucketOffsets.end() - 1);
+        for (size_t column = 0; column < spaces.size(); ++column)
+        {
+            for (const SpaceEntry &entry : spaces[column])
+            {
+                buckets[fill[entry.node]++] = make_pair(int(column), entry.cost);
+            }
+        }
+
+        for (size_t row = 0; row < sources.size(); ++row)
+        {
+            int source = sources[row];
+            if (source == -1)
+            {
+                continue;
+            }
+            pool.submit([&, row, source]()
+                        {
+                            SearchWorkspace &work = workspaces[pool.workerIndex()];
+                            double *costs = matrix.costs.data() + row * targets.size();
+                            int *meeting = withPaths ? matrix.meeting.data() + row * targets.size() : nullptr;
+                            vector<pair<int, int>> *space = withPaths ? &matrix.upwardSpaces[row] : nullptr;
+                            ch.upwardSearch(source, true, work, [&](int v, double cost)
+                                            {
+                                                if (space)
+                                                {
+                                                    space->push_back(make_pair(v, work.parentEdge[v]));
+                                                }
+                                                for (int i = bucketOffsets[v]; i < bucketOffsets[v + 1]; ++i)
+                                                {
+                                                    const pair<int, double> &entry = buckets[i];
+                                                    if (cost + entry.second < costs[entry.first])
+                                                    {
+                                                        costs[entry.first] = cost + entry.second;
+                                                        if (meeting)
+                                                        {
+                                                            meeting[entry.first] = v;
+                                                        }
+                                                    }
+                                                }
+                                            });
+                            if (space)
+                            {
+                                sort(space->begin(), space->end());
+                            }
+                        });
+        }
+        pool.wait();
+
+        if (withPaths)
+        {
+            for (size_t column = 0; column < spaces.size(); ++column)
+            {
+                for (const SpaceEntry &entry : spaces[column])
+                {
+                    matrix.downwardSpaces[column].push_back(make_pair(entry.node, entry.parentArc));
+                }
+            }
+        }
+    }
+
+    // Cost of the cheapest path from source to every node (infinity when unreachable)
+    static void singleSourceCosts(const CompactCityGraph &graph, int source, vector<double> &cost)
+    {
+        cost.assign(graph.nodeCount(), numeric_limits<double>::infinity());
+        typedef pair<double, int> QueueEntry;
+        priority_queue<QueueEntry, vector<QueueEntry>, greater<QueueEntry>> queue;
+        cost[source] = 0.0;
+        queue.push(QueueEntry(0.0, source));
+        while (!queue.empty())
+        {
+            QueueEntry top = queue.top();
+            queue.pop();
+            int node = top.second;
+            if (top.first > cost[node])
+            {
+                continue;
+            }
+            for (int e = graph.offsets[node]; e < graph.offsets[node + 1]; ++e)
+            {
+                double candidate = top.first + graph.edgeCost(e);
+                if (candidate < cost[graph.targets[e]])
+                {
+                    cost[graph.targets[e]] = candidate;
+                    queue.push(QueueEntry(candidate, graph.targets[e]));
+                }
+            }
+        }
+    }
+
+    // Rows of the bulk importers
+    class NodeRow
+    {
+    public:
+        int id;
+        string type;
+    };
+
+    class EdgeRow
+    {
+    public:
+        int source, destination, distance, traffic, redLight;
+    };
+
+    class StopRow
+    {
+    public:
+        string stopId;
+        int locationType = 0;
+    };
+
+    class StopTimeRow
+    {
+    public:
+        string tripId;
+        string stopId;
+        int sequence;
+        int arrival;   // seconds, -1 when not given
+        int departure; // seconds, -1 when not given
+    };
+
+    // Working state of one branch-and-bound search
+    class BranchAndBound
+    {
+    public:
+        const CompactCityGraph &graph;
+        const SearchLimits &limits;
+        SearchStats &stats;
+        int endNode;
+        vector<double> remaining; // lower bound on the cost from a node to endNode
+        vector<int> hopsLeft;     // fewest hops from a node to endNode
+        vector<char> visited;
+        vector<int> currentEdges;
+        vector<int> bestEdges;
+        double bestCost;
+
+        BranchAndBound(const CompactCityGraph &_graph, const SearchLimits &_limits, SearchStats &_stats, int _endNode)
+            : graph(_graph), limits(_limits), stats(_stats), endNode(_endNode), visited(_graph.nodeCount(), 0), bestCost(numeric_limits<double>::infinity()) {}
+
+        void search(int currentNode, double currentCost)
+        {
+            if (currentNode == endNode)
+            {
+                if (currentCost < bestCost && currentCost <= limits.maxScore)
+                {
+                    bestCost = currentCost;
+                    bestEdges = currentEdges;
+                    ++stats.pathsFound;
+                }
+                return;
+            }
+
+            ++stats.nodesExpanded;
+            visited[currentNode] = 1;
+
+            // With a lower bound, try the most promising edges first so a good
+            // incumbent is found early and later branches are cut sooner
+            int first = graph.offsets[currentNode];
+            int last = graph.offsets[currentNode + 1];
+            vector<pair<double, int>> order;
+            order.reserve(last - first);
+            for (int e = first; e < last; ++e)
+            {
+                order.push_back(make_pair(graph.edgeCost(e) + remaining[graph.targets[e]], e));
+            }
+            if (limits.pruning == LowerBoundPruning)
+            {
+                sort(order.begin(), order.end());
+            }
+
+            for (const auto &entry : order)
+            {
+                int e = entry.second;
+                int next = graph.targets[e];
+                if (visited[next])
+                {
+                    continue;
+                }
+                double nextCost = currentCost + graph.edgeCost(e);
+                double bound = nextCost + remaining[next];
+                bool overHops = limits.maxHops >= 0 && int(currentEdges.size()) + 1 + hopsLeft[next] > limits.maxHops;
+                bool overScore = bound > limits.maxScore;
+                bool cannotWin = limits.pruning != NoPruning && bound >= bestCost;
+                if (overHops || overScore || cannotWin)
+                {
+                    ++stats.branchesCut;
+                    continue;
+                }
+                currentEdges.push_back(e);
+                search(next, nextCost);
+                currentEdges.pop_back();
+            }
+            visited[currentNode] = 0;
+        }
+    };
+
+    // Display a path
+    void displayPath(const vector<int> &path)
+    {
+        for (size_t i = 0; i < path.size(); ++i)
+        {
+            cout << path[i];
+            if (i < path.size() - 1)
+            {
+                cout << " -> ";
+            }
+        }
+
+        cout << endl;
+    }
+
+public:
+    // Translate a node id path into the CSR slots of its edges, taking the cheapest of
+    // parallel edges so the score of a node path is that of its best route
+    EdgePath toEdgePath(const vector<int> &path)
+    {
+        const CompactCityGraph &graph = compact();
+        EdgePath edgePath;
+        if (path.empty() || nodeIndex.find(path[0]) == -1)
+        {
+            return edgePath;
+        }
+        edgePath.start = nodeIndex.find(path[0]);
+        for (size_t i = 0; i + 1 < path.size(); ++i)
+        {
+            int source = nodeIndex.find(path[i]);
+            int destination = nodeIndex.find(path[i + 1]);
+            if (source != -1 && destination != -1)
+            {
+                int edge = graph.findCheapestEdge(source, destination);
+                if (edge != -1)
+                {
+                    edgePath.edges.push_back(edge);
+                }
+            }
+        }
+        return edgePath;
+    }
+
+    // Calculate the convenience score for a path
+    double calculateConvenienceScore(const vector<int> &path)
+    {
+        return compact().pathCost(toEdgePath(path));
+    }
+
+    // Score of a path given as CSR edge slots, as returned by findBestEdgePath
+    double calculateConvenienceScore(const EdgePath &path)
+    {
+        return compact().pathCost(path);
+    }
+
+    // Add a new node to the city
+    void addNode(int nodeId, const string &nodeType)
+    {
+        addNode(nodeId, nodeType, numeric_limits<double>::quiet_NaN(), numeric_limits<double>::quiet_NaN());
+    }
+
+    // Add a new node at map position (x, y), in the unit of the edge distances
+    void addNode(int nodeId, const string &nodeType, double x, double y)
+    {
+        materializeNodes();
+        const char *type = nodeTypes.insert(nodeType).first->c_str();
+        CityNode *newNode = arena.create<CityNode>(nodeId, type, &arena, x, y);
+        newNode->index = city.size();
+        nodeIndex.insert(nodeId, newNode->index);
+        city.push_back(newNode);
+        markChanged();
+    }
+
+    // Add a weighted directed edge from node1 to node2
+    void addEdge(int node1, int node2, int distance, int traffic, int redLight)
+    {
+        CityNode *source = findNode(node1);
+        CityNode *destination = findNode(node2);
+
+        if (source && destination)
+        {
+            EdgeInfo edgeInfo(distance, traffic, redLight);
+            CityEdge *newEdge = arena.create<CityEdge>(source, destination, edgeInfo);
+            source->edges.push_back(newEdge);
+            bool indexed = !reachabilityDirty;
+            markChanged();
+            // Most new edges leave the components as they are: patch the index in place.
+            // Bulk imports mark it dirty up front, so they skip this.
+            if (indexed && reachability.addEdge(source->index, destination->index))
+            {
+                reachabilityDirty = false;
+            }
+        }
+    }
+
+    // Stream every simple path from start to end into the visitor, in DFS order,
+    // without storing them. Returns the number of paths visited.
+    size_t forEachPath(int start, int end, const PathVisitor &visitor)
+    {
+        PROFILE_SCOPE("forEachPath");
+        int startIndex = nodeIndex.find(start);
+        int endIndex = nodeIndex.find(end);
+        if (startIndex == -1 || endIndex == -1 || !reachabilityIndex().mayReach(startIndex, endIndex))
+        {
+            return 0;
+        }
+
+        const CompactCityGraph &graph = compact();
+        vector<int> currentEdges;
+        vector<char> visitedNodes(graph.nodeCount(), 0);
+        size_t pathCount = 0;
+        forEachPathHelper(graph, startIndex, startIndex, endIndex, currentEdges, 0.0, visitedNodes, [&](const PathView &path)
+                          {
+                              ++pathCount;
+                              return visitor(path);
+                          });
+        return pathCount;
+    }
+
+    // Print every path with its score while it is found, then the most convenient one.
+    // Only the current path and the best one so far are kept in memory.
+    // Returns the number of paths found.
+    size_t findAllPaths(int start, int end)
+    {
+        PROFILE_SCOPE("findAllPaths");
+        int startIndex = nodeIndex.find(start);
+        int endIndex = nodeIndex.find(end);
+
+        if (startIndex == -1 || endIndex == -1)
+        {
+            cout << "Invalid start or end node." << endl;
+            return 0;
+        }
+
+        cout << "All paths from " << nodeType(startIndex) << start << " to " << nodeType(endIndex) << end << ":" << endl;
+        TopKPaths best(1);
+        size_t pathCount = forEachPath(start, end, [&](const PathView &path)
+                                       {
+                                           {
+                                               PROFILE_HOT_SCOPE("findAllPaths.print");
+                                               vector<int> ids = path.nodeIds();
+                                               for (size_t i = 0; i < ids.size(); ++i)
+                                               {
+                                                   cout << ids[i] << (i + 1 < ids.size() ? " -> " : "");
+                                               }
+                                               cout << "   (convenient score  " << path.cost << ")" << endl;
+                                           }
+                                           PROFILE_HOT_SCOPE("findAllPaths.score");
+                                           best.offer(path);
+                                           return true;
+                                       });
+
+        cout << endl
+             << "MOST CONVENIENT PATH  IS";
+
+        cout << endl
+             << endl;
+
+        if (pathCount > 0)
+        {
+            cout << "Most convenient path: ";
+            displayPath(best.sorted().front().second);
+        }
+        else
+        {
+            cout << "No paths found." << endl;
+        }
+        return pathCount;
+    }
+
+    // The k cheapest paths by exhaustive enumeration, cheapest first
+    vector<pair<double, vector<int>>> findTopPaths(int start, int end, size_t k)
+    {
+        TopKPaths best(k);
+        forEachPath(start, end, best.visitor());
+        return best.sorted();
+    }
+
+    // Enumerate every simple path like findAllPaths, without printing anything
+    vector<vector<int>> collectAllPaths(int start, int end)
+    {
+        vector<vector<int>> paths;
+        forEachPath(start, end, [&paths](const PathView &path)
+                    {
+                        paths.push_back(path.nodeIds());
+                        return true;
+                    });
+        return paths;
+    }
+
+    // Enumerate every simple path like findAllPaths, split over a work-stealing pool.
+    // Paths come back in no particular order and nothing is printed.
+    vector<vector<int>> findAllPathsParallel(int start, int end, ThreadPool &pool)
+    {
+        vector<vector<int>> paths;
+        int startIndex = nodeIndex.find(start);
+        int endIndex = nodeIndex.find(end);
+        if (startIndex == -1 || endIndex == -1 || !reachabilityIndex().mayReach(startIndex, endIndex))
+        {
+            return paths;
+        }
+
+        const CompactCityGraph &graph = compact();
+        vector<PathBatch> results(pool.size());
+        vector<uint64_t> visited((graph.nodeCount() + 63) / 64, 0);
+        int source = startIndex;
+        int target = endIndex;
+        pool.submit([&graph, &pool, source, target, visited, &results]()
+                    { enumerateTask(graph, pool, source, source, target, vector<int>(), visited, results); });
+        pool.wait();
+
+        for (const PathBatch &batch : results)
+        {
+            for (size_t i = 0; i < batch.size(); ++i)
+            {
+                paths.push_back(graph.nodePath(batch.get(i)));
+            }
+        }
+        return paths;
+    }
+
+    vector<vector<int>> findAllPathsParallel(int start, int end, int threadCount = thread::hardware_concurrency())
+    {
+        ThreadPool pool(threadCount);
+        return findAllPathsParallel(start, end, pool);
+    }
+
+    // Find the most convenient path with Dijkstra over the per-edge convenience cost.
+    // Every edge cost is positive, so the cheapest walk is always a simple path and
+    // the result matches the minimum over all paths enumerated by findAllPaths,
+    // without ever building the full path list.
+    vector<int> findBestPath(int start, int end, SearchStats *stats = nullptr)
+    {
+        EdgePath path = findBestEdgePath(start, end, stats);
+        return path.start == -1 ? vector<int>() : compact().nodePath(path);
+    }
+
+    // Same query, returning the CSR edge slots of the path (start == -1 when there is none).
+    // stats, when given, counts the settled nodes.
+    EdgePath findBestEdgePath(int start, int end, SearchStats *stats = nullptr)
+    {
+        EdgePath path;
+        int startIndex = nodeIndex.find(start);
+        int endIndex = nodeIndex.find(end);
+        if (startIndex == -1 || endIndex == -1 || !reachabilityIndex().mayReach(startIndex, endIndex))
+        {
+            return path;
+        }
+
+        compact().shortestPath(startIndex, endIndex, nullptr, nullptr, path, stats);
+        return path;
+    }
+
+    // Most convenient path by bidirectional A*. The forward search is ordered by
+    // d(v) + p(v) and the backward search by d(v) - p(v), with the average potential
+    // p(v) = (h(v, end) - h(start, v)) / 2 of the lower bounds selected by mode. Both
+    // searches stay consistent, so the usual bidirectional stopping rule stays exact and
+    // the cost matches findBestPath. stats.nodesExpanded counts the nodes settled by both
+    // searches, stats.branchesCut the edges into nodes the bounds prove to lie on no route.
+    EdgePath findBestEdgePathAStar(int start, int end, SearchStats &stats, HeuristicMode mode = CombinedHeuristic)
+    {
+        PROFILE_SCOPE("findBestPathAStar");
+        EdgePath path;
+        int source = nodeIndex.find(start);
+        int target = nodeIndex.find(end);
+        if (source == -1 || target == -1 || !reachabilityIndex().mayReach(source, target))
+        {
+            return path;
+        }
+        const CompactCityGraph &reverse = reverseTopology();
+        const CompactCityGraph &graph = compact();
+        const double infinity = numeric_limits<double>::infinity();
+
+        bool useGeometry = (mode == GeometricHeuristic || mode == CombinedHeuristic) && hasGeometricBound();
+        int active[LandmarkIndex::activeLandmarks];
+        int activeCount = 0;
+        if ((mode == LandmarkHeuristic || mode == CombinedHeuristic) && hasLandmarks())
+        {
+            activeCount = landmarks->selectActive(source, target, active);
+        }
+        // Lower bound on the cost from v to w, infinity when v provably cannot reach w
+        auto bound = [&](int v, int w)
+        {
+            double h = activeCount > 0 ? landmarks->lowerBound(v, w, active, activeCount) : 0.0;
+            if (useGeometry)
+            {
+                double hops = ceil(hypot(graph.x[w] - graph.x[v], graph.y[w] - graph.y[v]) / maxEdgeLength - 1e-9);
+                h = max(h, hops * minEdgeCost);
+            }
+            return h;
+        };
+        // Infinity marks a node that lies on no path from source to target
+        auto potential = [&](int v)
+        {
+            double toTarget = bound(v, target);
+            double fromSource = bound(source, v);
+            return toTarget == infinity || fromSource == infinity ? infinity : (toTarget - fromSource) / 2;
+        };
+
+        forwardSearch.reset(graph.nodeCount());
+        backwardSearch.reset(graph.nodeCount());
+        double sourcePotential = potential(source);
+        double targetPotential = potential(target);
+        if (sourcePotential == infinity || targetPotential == infinity)
+        {
+            return path;
+        }
+        forwardSearch.relax(source, 0.0, -1, sourcePotential);
+        backwardSearch.relax(target, 0.0, -1, -targetPotential);
+        double best = infinity;
+        int meeting = -1;
+        bool goForward = false;
+        while (!forwardSearch.heap.empty() && !backwardSearch.heap.empty())
+        {
+            if (forwardSearch.heap.front().first + backwardSearch.heap.front().first >= best)
+            {
+                break;
+            }
+            goForward = !goForward;
+            SearchWorkspace &work = goForward ? forwardSearch : backwardSearch;
+            const SearchWorkspace &other = goForward ? backwardSearch : forwardSearch;
+            pair<double, int> top = work.pop();
+            int v = top.second;
+            double p = potential(v);
+            if (top.first != (goForward ? work.cost[v] + p : work.cost[v] - p))
+            {
+                continue; // stale queue entry
+            }
+            ++stats.nodesExpanded;
+            PROFILE_COUNT(NodesExpandedCounter, 1);
+            if (other.reached(v) && work.cost[v] + other.cost[v] < best)
+            {
+                best = work.cost[v] + other.cost[v];
+                meeting = v;
+            }
+
+            // Both searches label nodes with forward CSR slots; the backward one walks
+            // the in-edges of the reversed topology
+            const CompactCityGraph &side = goForward ? graph : reverse;
+            for (int e = side.offsets[v]; e < side.offsets[v + 1]; ++e)
+            {
+                int next = side.targets[e];
+                int slot = goForward ? e : reverseSlots[e];
+                double candidate = work.cost[v] + graph.cost[slot];
+                if (candidate >= work.costOf(next))
+                {
+                    continue;
+                }
+                double nextPotential = potential(next);
+                if (nextPotential == infinity)
+                {
+                    ++stats.branchesCut;
+                    continue;
+                }
+                PROFILE_COUNT(EdgesRelaxedCounter, 1);
+                work.relax(next, candidate, slot, goForward ? candidate + nextPotential : candidate - nextPotential);
+                if (other.reached(next) && candidate + other.cost[next] < best)
+                {
+                    best = candidate + other.cost[next];
+                    meeting = next;
+                }
+            }
+        }
+        if (meeting == -1)
+        {
+            return path;
+        }
+
+        path = forwardSearch.pathTo(graph, source, meeting);
+        for (int v = meeting; v != target; v = graph.targets[backwardSearch.parentEdge[v]])
+        {
+            path.edges.push_back(backwardSearch.parentEdge[v]);
+        }
+        ++stats.pathsFound;
+        return path;
+    }
+
+    vector<int> findBestPathAStar(int start, int end, SearchStats &stats, HeuristicMode mode = CombinedHeuristic)
+    {
+        EdgePath path = findBestEdgePathAStar(start, end, stats, mode);
+        return path.start == -1 ? vector<int>() : compact().nodePath(path);
+    }
+
+    // Most convenient route when riders may change vehicles. The search runs on the
+    // product of the graph and the travel modes: state (v, mode) means being at v in that
+    // mode, with moves to (w, mode) along every edge v -> w and to (v, other) where the
+    // type of v offers the other mode. States and moves are generated from the CSR as the
+    // search goes, so only the labels grow with the number of modes. stats, when given,
+    // counts the settled states.
+    MultimodalRoute findMultimodalRoute(int start, int end, const ModeProfile &profile = ModeProfile(), SearchStats *stats = nullptr)
+    {
+        PROFILE_SCOPE("findMultimodalRoute");
+        MultimodalRoute route;
+        int source = nodeIndex.find(start);
+        int target = nodeIndex.find(end);
+        if (source == -1 || target == -1 || !reachabilityIndex().mayReach(source, target))
+        {
+            return route;
+        }
+        for (int mode = 0; mode < TravelModeCount; ++mode)
+        {
+            if (!(profile.costFactor[mode] >= 0.0))
+            {
+                throw logic_error("findMultimodalRoute: negative cost factor");
+            }
+        }
+        const CompactCityGraph &graph = compact();
+        const vector<int> &types = nodeTypeIds();
+        const int modes = TravelModeCount;
+        const double infinity = numeric_limits<double>::infinity();
+
+        // Boarding penalties by type id, resolved once per query
+        vector<double> penalty(typeIdNames.size() * modes);
+        for (size_t type = 0; type < typeIdNames.size(); ++type)
+        {
+            for (int mode = 0; mode < modes; ++mode)
+            {
+                penalty[type * modes + mode] = profile.boardingPenalty(typeIdNames[type], TravelMode(mode));
+            }
+        }
+
+        // parentEdge of a state: the CSR slot it was reached through, or -2 - mode for a
+        // change of vehicle from that mode at the same node
+        modeSearch.reset(graph.nodeCount() * modes);
+        for (int mode = 0; mode < modes; ++mode)
+        {
+            if (penalty[types[source] * modes + mode] < infinity)
+            {
+                modeSearch.relax(source * modes + mode, penalty[types[source] * modes + mode], -1);
+            }
+        }
+        int reached = -1;
+        while (!modeSearch.heap.empty())
+        {
+            pair<double, int> top = modeSearch.pop();
+            int state = top.second;
+            if (top.first > modeSearch.cost[state])
+            {
+                continue; // stale queue entry
+            }
+            if (stats)
+            {
+                ++stats->nodesExpanded;
+            }
+            PROFILE_COUNT(NodesExpandedCounter, 1);
+            int v = state / modes;
+            int mode = state % modes;
+            if (v == target)
+            {
+                reached = state;
+                break;
+            }
+            for (int e = graph.offsets[v]; e < graph.offsets[v + 1]; ++e)
+            {
+                int next = graph.targets[e] * modes + mode;
+                double candidate = top.first + profile.costFactor[mode] * graph.cost[e];
+                if (candidate < modeSearch.costOf(next))
+                {
+                    PROFILE_COUNT(EdgesRelaxedCounter, 1);
+                    modeSearch.relax(next, candidate, e);
+                }
+            }
+            for (int other = 0; other < modes; ++other)
+            {
+                double candidate = top.first + penalty[types[v] * modes + other];
+                if (other != mode && candidate < modeSearch.costOf(v * modes + other))
+                {
+                    PROFILE_COUNT(EdgesRelaxedCounter, 1);
+                    modeSearch.relax(v * modes + other, candidate, -2 - mode);
+                }
+            }
+        }
+        if (reached == -1)
+        {
+            return route;
+        }
+
+        route.cost = modeSearch.cost[reached];
+        route.path.push_back(graph.nodeIds[target]);
+        for (int state = reached; modeSearch.parentEdge[state] != -1;)
+        {
+            int parent = modeSearch.parentEdge[state];
+            int mode = state % modes;
+            if (parent >= 0)
+            {
+                int previous = graph.edgeSource(parent);
+                route.path.push_back(graph.nodeIds[previous]);
+                route.edgeModes.push_back(TravelMode(mode));
+                state = previous * modes + mode;
+            }
+            else
+            {
+                state = state - mode + (-2 - parent);
+            }
+        }
+        reverse(route.path.begin(), route.path.end());
+        reverse(route.edgeModes.begin(), route.edgeModes.end());
+        return route;
+    }
+
+    // Every node reachable from start at a cost of at most budget, as (node id, cost)
+    // pairs in order of increasing cost, start first. The Dijkstra stops at the budget
+    // and runs in a workspace kept by the graph, so once it is sized a query allocates
+    // nothing beyond reached (cleared, capacity kept) and costs only the nodes it
+    // touches. Returns the number of nodes reached; none for an unknown start.
+    size_t isochrone(int start, double budget, vector<pair<int, double>> &reached, CostMetric metric = ConvenienceMetric, SearchStats *stats = nullptr)
+    {
+        PROFILE_SCOPE("isochrone");
+        reached.clear();
+        int source = nodeIndex.find(start);
+        if (source == -1 || !(budget >= 0.0))
+        {
+            return 0;
+        }
+        const CompactCityGraph &graph = compact();
+        isochroneSearch.reset(graph.nodeCount());
+        isochroneSearch.relax(source, 0.0, -1);
+        while (!isochroneSearch.heap.empty())
+        {
+            pair<double, int> top = isochroneSearch.pop();
+            int v = top.second;
+            if (top.first > isochroneSearch.cost[v])
+            {
+                continue; // stale queue entry
+            }
+            if (stats)
+            {
+                ++stats->nodesExpanded;
+            }
+            PROFILE_COUNT(NodesExpandedCounter, 1);
+            reached.push_back(make_pair(graph.nodeIds[v], top.first));
+            for (int e = graph.offsets[v]; e < graph.offsets[v + 1]; ++e)
+            {
+                double candidate = top.first + (metric == DistanceMetric ? double(graph.distance[e]) : graph.cost[e]);
+                if (candidate <= budget && candidate < isochroneSearch.costOf(graph.targets[e]))
+                {
+                    PROFILE_COUNT(EdgesRelaxedCounter, 1);
+                    isochroneSearch.relax(graph.targets[e], candidate, e);
+                }
+            }
+        }
+        return reached.size();
+    }
+
+    vector<pair<int, double>> isochrone(int start, double budget, CostMetric metric = ConvenienceMetric)
+    {
+        vector<pair<int, double>> reached;
+        isochrone(start, budget, reached, metric);
+        return reached;
+    }
+
+    // Most convenient path found by depth-first branch and bound. Every edge cost is
+    // non-negative, so a partial path that already costs as much as the best complete
+    // path can never win; LowerBoundPruning adds the exact cheapest cost to the end
+    // (a reverse Dijkstra that ignores the visited set, hence admissible). Unlike
+    // findBestPath it honours a maximum number of hops. Returns an empty path when no
+    // path satisfies the limits.
+    vector<int> findBestPathBounded(int start, int end, const SearchLimits &limits, SearchStats &stats)
+    {
+        int startIndex = nodeIndex.find(start);
+        int endIndex = nodeIndex.find(end);
+        if (startIndex == -1 || endIndex == -1 || !reachabilityIndex().mayReach(startIndex, endIndex))
+        {
+            return vector<int>();
+        }
+
+        const CompactCityGraph &graph = compact();
+        BranchAndBound search(graph, limits, stats, endIndex);
+        CompactCityGraph reverse;
+        if (limits.pruning == LowerBoundPruning || limits.maxScore < numeric_limits<double>::infinity() || limits.maxHops >= 0)
+        {
+            reverse = graph.reversed();
+        }
+        if (limits.pruning == LowerBoundPruning || limits.maxScore < numeric_limits<double>::infinity())
+        {
+            singleSourceCosts(reverse, endIndex, search.remaining);
+        }
+        else
+        {
+            search.remaining.assign(graph.nodeCount(), 0.0);
+        }
+        search.hopsLeft.assign(graph.nodeCount(), 0);
+        if (limits.maxHops >= 0)
+        {
+            // Breadth-first search on the reversed graph
+            search.hopsLeft.assign(graph.nodeCount(), numeric_limits<int>::max() / 2);
+            vector<int> frontier(1, endIndex);
+            search.hopsLeft[endIndex] = 0;
+            for (size_t head = 0; head < frontier.size(); ++head)
+            {
+                int node = frontier[head];
+                for (int e = reverse.offsets[node]; e < reverse.offsets[node + 1]; ++e)
+                {
+                    if (search.hopsLeft[reverse.targets[e]] > search.hopsLeft[node] + 1)
+                    {
+                        search.hopsLeft[reverse.targets[e]] = search.hopsLeft[node] + 1;
+                        frontier.push_back(reverse.targets[e]);
+                    }
+                }
+            }
+        }
+
+        if (limits.maxHops < 0 || search.hopsLeft[startIndex] <= limits.maxHops)
+        {
+            search.search(startIndex, 0.0);
+        }
+        if (search.bestCost == numeric_limits<double>::infinity())
+        {
+            return vector<int>();
+        }
+        return graph.nodePath(startIndex, search.bestEdges.data(), search.bestEdges.size());
+    }
+
+    // The k most convenient loopless paths, cheapest first, using Yen's algorithm.
+    // Each round takes the last accepted path and, for every node on it (the spur
+    // node), looks for the cheapest deviation that keeps the same prefix (the root
+    // path) but avoids the edges already used after that prefix by accepted paths
+    // and the root's own nodes. Runs k * pathLength Dijkstra searches in the worst case.
+    vector<pair<double, vector<int>>> kBestPaths(int start, int end, size_t k)
+    {
+        vector<pair<double, vector<int>>> result;
+        int startIndex = nodeIndex.find(start);
+        int endIndex = nodeIndex.find(end);
+        if (startIndex == -1 || endIndex == -1 || k == 0 || !reachabilityIndex().mayReach(startIndex, endIndex))
+        {
+            return result;
+        }
+
+        const CompactCityGraph &graph = compact();
+        vector<EdgePath> accepted;
+        EdgePath best;
+        double bestCost = graph.shortestPath(startIndex, endIndex, nullptr, nullptr, best);
+        if (best.start == -1)
+        {
+            return result;
+        }
+        accepted.push_back(best);
+        result.push_back(make_pair(bestCost, graph.nodePath(best)));
+
+        set<pair<double, vector<int>>> candidates; // (cost, edge slots)
+        set<vector<int>> seen;                     // edge slots of every accepted or candidate path
+        seen.insert(best.edges);
+        vector<char> bannedNodes(graph.nodeCount(), 0);
+        vector<char> bannedEdges(graph.edgeCount(), 0);
+
+        while (accepted.size() < k)
+        {
+            const vector<int> previous = accepted.back().edges;
+            int spurNode = accepted.back().start;
+            for (size_t i = 0; i < previous.size(); ++i)
+            {
+                // Edges leaving the spur node that accepted paths with the same root already took
+                vector<int> bannedEdgeList;
+                for (const EdgePath &path : accepted)
+                {
+                    if (path.edges.size() > i && equal(previous.begin(), previous.begin() + i, path.edges.begin()))
+                    {
+                        bannedEdges[path.edges[i]] = 1;
+                        bannedEdgeList.push_back(path.edges[i]);
+                    }
+                }
+                // The root path's nodes before the spur node must not be revisited
+                vector<int> bannedNodeList;
+                int rootNode = accepted.back().start;
+                for (size_t j = 0; j < i; ++j)
+                {
+                    bannedNodes[rootNode] = 1;
+                    bannedNodeList.push_back(rootNode);
+                    rootNode = graph.targets[previous[j]];
+                }
+
+                EdgePath spur;
+                graph.shortestPath(spurNode, endIndex, &bannedNodes, &bannedEdges, spur);
+                if (spur.start != -1)
+                {
+                    vector<int> edges(previous.begin(), previous.begin() + i);
+                    edges.insert(edges.end(), spur.edges.begin(), spur.edges.end());
+                    if (seen.insert(edges).second)
+                    {
+                        candidates.insert(make_pair(graph.pathCost(edges.data(), edges.size()), edges));
+                    }
+                }
+
+                for (int e : bannedEdgeList)
+                {
+                    bannedEdges[e] = 0;
+                }
+                for (int node : bannedNodeList)
+                {
+                    bannedNodes[node] = 0;
+                }
+                spurNode = graph.targets[previous[i]];
+            }
+
+            if (candidates.empty())
+            {
+                break;
+            }
+            EdgePath next;
+            next.start = startIndex;
+            next.edges = candidates.begin()->second;
+            result.push_back(make_pair(candidates.begin()->first, graph.nodePath(next)));
+            candidates.erase(candidates.begin());
+            accepted.push_back(next);
+        }
+        return result;
+    }
+
+    size_t graphVersion() const { return version; }
+
+    int nodeCount() { return compact().nodeCount(); }
+    int edgeCount() { return compact().edgeCount(); }
+
+    // Write the graph in the binary format loadBinary maps: a versioned, checksummed
+    // header followed by the CSR columns, the node types and the type names
+    void saveBinary(const string &path)
+    {
+        const CompactCityGraph &graph = compact();
+        size_t n = graph.nodeCount();
+        size_t m = graph.edgeCount();
+
+        unordered_map<string, int> typeIds;
+        string typeNames;
+        vector<int> types(n);
+        for (size_t v = 0; v < n; ++v)
+        {
+            string type = nodeType(v);
+            auto found = typeIds.find(type);
+            if (found == typeIds.end())
+            {
+                found = typeIds.insert(make_pair(type, int(typeIds.size()))).first;
+                typeNames += type;
+                typeNames += '\0';
+            }
+            types[v] = found->second;
+        }
+
+        GraphFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, graphFileMagic, sizeof(header.magic));
+        header.formatVersion = GraphFileHeader::currentVersion;
+        header.byteOrder = GraphFileHeader::byteOrderMark;
+        header.nodeCount = n;
+        header.edgeCount = m;
+        header.typeCount = typeIds.size();
+
+        const void *sources[GraphFileSectionCount] = {graph.nodeIds.data(), types.data(), graph.offsets.data(), graph.targets.data(), graph.distance.data(), graph.traffic.data(), graph.redLight.data(), graph.cost.data(), graph.x.data(), graph.y.data(), typeNames.data()};
+        size_t bytes[GraphFileSectionCount] = {n * sizeof(int), n * sizeof(int), (n + 1) * sizeof(int), m * sizeof(int), m * sizeof(int), m * sizeof(int), m * sizeof(int), m * sizeof(double), n * sizeof(double), n * sizeof(double), typeNames.size()};
+        size_t position = sizeof(header);
+        for (int section = 0; section < GraphFileSectionCount; ++section)
+        {
+            position = (position + 63) & ~size_t(63);
+            header.sections[section] = position;
+            header.sectionBytes[section] = bytes[section];
+            position += bytes[section];
+        }
+        header.fileBytes = position;
+
+        vector<char> image(position, 0);
+        for (int section = 0; section < GraphFileSectionCount; ++section)
+        {
+            if (bytes[section] > 0)
+            {
+                memcpy(image.data() + header.sections[section], sources[section], bytes[section]);
+            }
+        }
+        header.payloadChecksum = checksum64(image.data() + sizeof(header), image.size() - sizeof(header));
+        header.headerChecksum = checksum64(reinterpret_cast<const char *>(&header), offsetof(GraphFileHeader, headerChecksum));
+        memcpy(image.data(), &header, sizeof(header));
+
+        ofstream out(path, ios::binary | ios::trunc);
+        out.write(image.data(), image.size());
+        if (!out)
+        {
+            throw runtime_error("cannot write " + path);
+        }
+    }
+
+    // Load a file written by saveBinary into this graph, which must be empty. Nothing is
+    // parsed or copied: the file is mapped and the CSR columns point into it, so start-up
+    // cost stays a single pass over the id, type, CSR and weight columns, and processes
+    // loading the same file share their pages. The header, the CSR structure and the
+    // edge costs are always checked, so a corrupt file cannot lead queries out of range
+    // or give them negative or NaN costs; verify also checks the payload checksum,
+    // reading every byte of the file.
+    void loadBinary(const string &path, bool verify = false)
+    {
+        if (!city.empty() || nodesPending)
+        {
+            throw logic_error("loadBinary needs an empty graph");
+        }
+        shared_ptr<MappedFile> file = make_shared<MappedFile>(path);
+        GraphFileHeader header;
+        if (file->size < sizeof(header))
+        {
+            throw runtime_error(path + ": not a graph file");
+        }
+        memcpy(&header, file->data, sizeof(header));
+        if (memcmp(header.magic, graphFileMagic, sizeof(header.magic)) != 0)
+        {
+            throw runtime_error(path + ": not a graph file");
+        }
+        if (header.byteOrder != GraphFileHeader::byteOrderMark)
+        {
+            throw runtime_error(path + ": written with a different byte order");
+        }
+        if (header.formatVersion != GraphFileHeader::currentVersion)
+        {
+            throw runtime_error(path + ": unsupported format version " + to_string(header.formatVersion));
+        }
+        if (header.headerChecksum != checksum64(file->data, offsetof(GraphFileHeader, headerChecksum)) || header.fileBytes != file->size)
+        {
+            throw runtime_error(path + ": corrupt or truncated header");
+        }
+
+        uint64_t n = header.nodeCount;
+        uint64_t m = header.edgeCount;
+        if (n >= uint64_t(numeric_limits<int>::max()) || m >= uint64_t(numeric_limits<int>::max()))
+        {
+            throw runtime_error(path + ": graph too large");
+        }
+        uint64_t expected[GraphFileSectionCount] = {n * sizeof(int), n * sizeof(int), (n + 1) * sizeof(int), m * sizeof(int), m * sizeof(int), m * sizeof(int), m * sizeof(int), m * sizeof(double), n * sizeof(double), n * sizeof(double), header.sectionBytes[TypeNamesSection]};
+        for (int section = 0; section < GraphFileSectionCount; ++section)
+        {
+            if (header.sections[section] % 64 != 0 || header.sectionBytes[section] != expected[section] || expected[section] > file->size ||
+                header.sections[section] > file->size - expected[section])
+            {
+                throw runtime_error(path + ": corrupt section table");
+            }
+        }
+        if (verify && header.payloadChecksum != checksum64(file->data + sizeof(header), file->size - sizeof(header)))
+        {
+            throw runtime_error(path + ": checksum mismatch");
+        }
+
+        // Type names are few; intern them so nodes can point at them
+        vector<const char *> typeNames;
+        const char *name = file->data + header.sections[TypeNamesSection];
+        const char *namesEnd = name + header.sectionBytes[TypeNamesSection];
+        for (uint64_t t = 0; t < header.typeCount; ++t)
+        {
+            const char *nameEnd = static_cast<const char *>(memchr(name, '\0', namesEnd - name));
+            if (!nameEnd)
+            {
+                throw runtime_error(path + ": corrupt type names");
+            }
+            typeNames.push_back(nodeTypes.insert(string(name, nameEnd)).first->c_str());
+            name = nameEnd + 1;
+        }
+
+        CompactCityGraph graph;
+        auto section = [&](GraphFileSection which)
+        { return file->data + header.sections[which]; };
+        graph.nodeIds.view(reinterpret_cast<int *>(section(NodeIdsSection)), n);
+        graph.offsets.view(reinterpret_cast<int *>(section(OffsetsSection)), n + 1);
+        graph.targets.view(reinterpret_cast<int *>(section(TargetsSection)), m);
+        graph.distance.view(reinterpret_cast<int *>(section(DistanceSection)), m);
+        graph.traffic.view(reinterpret_cast<int *>(section(TrafficSection)), m);
+        graph.redLight.view(reinterpret_cast<int *>(section(RedLightSection)), m);
+        graph.cost.view(reinterpret_cast<double *>(section(CostSection)), m);
+        graph.x.view(reinterpret_cast<double *>(section(XSection)), n);
+        graph.y.view(reinterpret_cast<double *>(section(YSection)), n);
+        Column<int> types;
+        types.view(reinterpret_cast<int *>(section(NodeTypesSection)), n);
+
+        // Offsets, targets and node types are what queries index with
+        {
+            bool valid = graph.offsets[0] == 0 && uint64_t(graph.offsets[n]) == m;
+            for (uint64_t v = 0; valid && v < n; ++v)
+            {
+                valid = graph.offsets[v] <= graph.offsets[v + 1] && uint64_t(types[v]) < header.typeCount;
+            }
+            for (uint64_t e = 0; valid && e < m; ++e)
+            {
+                valid = uint64_t(graph.targets[e]) < n;
+            }
+            if (!valid)
+            {
+                throw runtime_error(path + ": corrupt graph structure");
+            }
+        }
+        // Searches need finite, non-negative costs, and the cost column has to agree
+        // with the weights it is cached from
+        for (uint64_t e = 0; e < m; ++e)
+        {
+            double cost = convenienceCost(graph.distance[e], graph.traffic[e], graph.redLight[e]);
+            if (!(cost >= 0.0 && cost < numeric_limits<double>::infinity() && fabs(graph.cost[e] - cost) <= 1e-12 * cost))
+            {
+                throw runtime_error(path + ": corrupt edge costs");
+            }
+        }
+
+        NodeIndex index;
+        for (uint64_t v = 0; v < n; ++v)
+        {
+            if (index.find(graph.nodeIds[v]) != -1)
+            {
+                throw runtime_error(path + ": duplicate node id " + to_string(graph.nodeIds[v]));
+            }
+            index.insert(graph.nodeIds[v], v);
+        }
+
+        graph.file = file;
+        compactGraph = std::move(graph);
+        nodeIndex = std::move(index);
+        fileTypeIds = std::move(types);
+        fileTypeNames = typeNames;
+        nodesPending = true;
+        markChanged();
+        compactDirty = false;
+    }
+
+    // Exact bytes held for nodes, edges and adjacency lists (the arena's blocks),
+    // and how many of them are in use
+    size_t storageBytes() const { return arena.reservedBytes(); }
+    size_t storageBytesInUse() const { return arena.usedBytes(); }
+
+    // Precompute the best route between every pair of nodes. The table is dropped as
+    // soon as the graph changes, and findRoute falls back to Dijkstra until it is rebuilt.
+    void precomputeRoutes(AllPairsMethod method = AutoAllPairs, int threadCount = thread::hardware_concurrency())
+    {
+        const CompactCityGraph &graph = compact();
+        unique_ptr<RouteTable> table(new RouteTable());
+        if (method == FloydWarshall || (method == AutoAllPairs && graph.nodeCount() <= 256))
+        {
+            table->buildFloydWarshall(graph);
+        }
+        else
+        {
+            ThreadPool pool(threadCount);
+            table->buildDijkstra(graph, pool);
+        }
+        table->version = version;
+        routeTable = move(table);
+    }
+
+    bool hasRouteTable() const { return routeTable && routeTable->version == version; }
+
+    // Preprocess a contraction hierarchy for fast exact queries on large graphs. Like the
+    // route table it belongs to one graph version: after edits or traffic updates
+    // findRoute falls back to Dijkstra until it is built again.
+    void buildContractionHierarchy()
+    {
+        hierarchy.reset(new ContractionHierarchy(compact()));
+        hierarchy->version = version;
+    }
+
+    bool hasContractionHierarchy() const { return hierarchy && hierarchy->version == version; }
+
+    const ContractionHierarchy *contractionHierarchy() const { return hierarchy.get(); }
+
+    // Precompute landmark distances for the ALT bounds of findBestPathAStar, which work
+    // without coordinates: two Dijkstra runs per landmark and 16 bytes per node and
+    // landmark. Like the contraction hierarchy they belong to one graph version.
+    void precomputeLandmarks(int count = 16)
+    {
+        landmarks.reset(new LandmarkIndex(compact(), count));
+        landmarks->version = version;
+    }
+
+    bool hasLandmarks() const { return landmarks && landmarks->version == version; }
+
+    const LandmarkIndex *landmarkIndex() const { return landmarks.get(); }
+
+    // Components and reachability of the current topology. Built on first use; addEdge
+    // keeps it up to date where it can, other changes rebuild it on the next query.
+    // Queries consult it first, so a pair without any path is rejected in O(1).
+    const ReachabilityIndex &reachabilityIndex()
+    {
+        if (reachabilityDirty)
+        {
+            reachability.build(compact());
+            reachabilityDirty = false;
+        }
+        return reachability;
+    }
+
+    // Whether any path leads from start to end
+    bool pathExists(int start, int end)
+    {
+        int startIndex = nodeIndex.find(start);
+        int endIndex = nodeIndex.find(end);
+        if (startIndex == -1 || endIndex == -1 || !reachabilityIndex().mayReach(startIndex, endIndex))
+        {
+            return false;
+        }
+        return reachability.exact() || findBestEdgePath(start, end).start != -1;
+    }
+
+    // Whether every node has coordinates, so findBestPathAStar can use the geometric bound
+    bool hasGeometricBound()
+    {
+        refreshGeometry();
+        return maxEdgeLength > 0.0;
+    }
+
+    // Publish an immutable snapshot of the current graph for concurrent readers.
+    // CityGraph itself is single-writer: addNode/addEdge/updateTraffic must come from
+    // one thread, which calls publish() when a batch of changes is complete
+    // (updateTraffic republishes by itself once a snapshot exists). Readers on any
+    // number of threads use readSnapshot() or findBestPathConcurrent() and never wait
+    // for the writer; each keeps the version it pinned until its reader goes away.
+    // The first publish after nodes or edges were added copies the ids, adjacency and
+    // id index; later ones share them and copy only the cost column, 8 bytes per edge
+    // (about 8 MB and a few ms for a million-edge city on every traffic batch).
+    void publish()
+    {
+        const CompactCityGraph &graph = compact();
+        if (!snapshotTopology)
+        {
+            snapshotTopology = make_shared<SnapshotTopology>(graph, nodeIndex);
+        }
+        snapshots.publish(new GraphSnapshot(version, snapshotTopology, graph.cost));
+    }
+
+    SnapshotReader readSnapshot() const
+    {
+        return SnapshotReader(snapshots);
+    }
+
+    // Bulk import of nodes from CSV rows "id,type"; a first line that is exactly that
+    // header is skipped. The file is streamed in chunks parsed in parallel, so its size
+    // is not limited by memory. Malformed rows (a malformed first line included) and ids
+    // already in the graph are rejected and reported.
+    ImportStats importNodesCsv(const string &path, int threadCount = thread::hardware_concurrency())
+    {
+        materializeNodes();
+        ThreadPool pool(threadCount);
+        size_t before = city.size();
+        ImportStats stats = importCsv<NodeRow>(
+            path, pool, [](const vector<CsvField> &fields)
+            {
+                return isCsvHeader(fields, {"id", "type"});
+            },
+            [](const vector<CsvField> &fields, NodeRow &row) -> const char *
+            {
+                if (fields.size() != 2)
+                {
+                    return "expected 2 fields: id,type";
+                }
+                if (!parseCsvInt(fields[0], row.id))
+                {
+                    return "node id is not an integer";
+                }
+                if (fields[1].first == fields[1].second)
+                {
+                    return "empty node type";
+                }
+                row.type = csvText(fields[1]);
+                return nullptr;
+            },
+            [this](const NodeRow &row) -> const char *
+            {
+                if (nodeIndex.find(row.id) != -1)
+                {
+                    return "duplicate node id";
+                }
+                addNode(row.id, row.type);
+                return nullptr;
+            });
+        stats.nodesAdded = city.size() - before;
+        return stats;
+    }
+
+    // Bulk import of edges from CSV rows "source,destination,distance,traffic,redLight";
+    // a first line that is exactly that header is skipped. Rows with missing or negative
+    // values, or with nodes that are not in the graph, are rejected and reported.
+    ImportStats importEdgesCsv(const string &path, int threadCount = thread::hardware_concurrency())
+    {
+        materializeNodes();
+        // Rebuilt once on the next query: patching it for every row costs far more
+        reachabilityDirty = true;
+        ThreadPool pool(threadCount);
+        ImportStats stats = importCsv<EdgeRow>(
+            path, pool, [](const vector<CsvField> &fields)
+            {
+                return isCsvHeader(fields, {"source", "destination", "distance", "traffic", "redLight"});
+            },
+            [](const vector<CsvField> &fields, EdgeRow &row) -> const char *
+            {
+                if (fields.size() != 5)
+                {
+                    return "expected 5 fields: source,destination,distance,traffic,redLight";
+                }
+                if (!parseCsvInt(fields[0], row.source) || !parseCsvInt(fields[1], row.destination) || !parseCsvInt(fields[2], row.distance) || !parseCsvInt(fields[3], row.traffic) || !parseCsvInt(fields[4], row.redLight))
+                {
+                    return "field is not an integer";
+                }
+                if (row.distance < 0 || row.traffic < 0 || row.redLight < 0)
+                {
+                    return "negative weight";
+                }
+                return nullptr;
+            },
+            [this](const EdgeRow &row) -> const char *
+            {
+                if (nodeIndex.find(row.source) == -1 || nodeIndex.find(row.destination) == -1)
+                {
+                    return "unknown node";
+                }
+                addEdge(row.source, row.destination, row.distance, row.traffic, row.redLight);
+                return nullptr;
+            });
+        stats.edgesAdded = stats.rowsImported;
+        return stats;
+    }
+
+    // Import a GTFS feed. Every stop of stops.txt becomes a node ("Station" for
+    // location_type 1, "Stop" otherwise) with an id after the largest one in the graph;
+    // stopIds receives the stop_id -> node id mapping when given. Consecutive rows of a
+    // trip in stop_times.txt (feeds list a trip's stops together, in stop_sequence
+    // order) give one edge per stop pair; its distance is the scheduled travel time in
+    // minutes (at least 1, Dlower when a time is missing), traffic and red lights take
+    // their lowest values. Pairs with both times also become timetable connections, one
+    // trip per run of rows, for earliestArrival.
+    ImportStats importGtfs(const string &stopsPath, const string &stopTimesPath, int threadCount = thread::hardware_concurrency(), unordered_map<string, int> *stopIds = nullptr)
+    {
+        materializeNodes();
+        ThreadPool pool(threadCount);
+        unordered_map<string, int> ids;
+        int nextId = 1;
+        for (CityNode *node : city)
+        {
+            nextId = max(nextId, node->id + 1);
+        }
+
+        int stopColumn = -1;
+        int locationColumn = -1;
+        ImportStats stats = importCsv<StopRow>(
+            stopsPath, pool, [&](const vector<CsvField> &fields)
+            {
+                stopColumn = csvColumn(fields, "stop_id");
+                locationColumn = csvColumn(fields, "location_type");
+                if (stopColumn == -1)
+                {
+                    throw runtime_error(stopsPath + ": no stop_id column");
+                }
+                return true;
+            },
+            [&](const vector<CsvField> &fields, StopRow &row) -> const char *
+            {
+                if (int(fields.size()) <= max(stopColumn, locationColumn))
+                {
+                    return "missing fields";
+                }
+                if (fields[stopColumn].first == fields[stopColumn].second)
+                {
+                    return "empty stop_id";
+                }
+                row.stopId = csvText(fields[stopColumn]);
+                if (locationColumn != -1 && fields[locationColumn].first != fields[locationColumn].second && !parseCsvInt(fields[locationColumn], row.locationType))
+                {
+                    return "location_type is not an integer";
+                }
+                return nullptr;
+            },
+            [&](const StopRow &row) -> const char *
+            {
+                if (!ids.insert(make_pair(row.stopId, nextId)).second)
+                {
+                    return "duplicate stop_id";
+                }
+                addNode(nextId++, row.locationType == 1 ? "Station" : "Stop");
+                return nullptr;
+            });
+        stats.nodesAdded = stats.rowsImported;
+
+        int tripColumn = -1, arrivalColumn = -1, departureColumn = -1, sequenceColumn = -1;
+        stopColumn = -1;
+        string previousTrip;
+        int previousStop = -1, previousSequence = 0, previousDeparture = -1;
+        int trip = -1; // timetable trip of the current run, created with its first connection
+        unordered_set<uint64_t> segments;
+        ImportStats times = importCsv<StopTimeRow>(
+            stopTimesPath, pool, [&](const vector<CsvField> &fields)
+            {
+                tripColumn = csvColumn(fields, "trip_id");
+                arrivalColumn = csvColumn(fields, "arrival_time");
+                departureColumn = csvColumn(fields, "departure_time");
+                stopColumn = csvColumn(fields, "stop_id");
+                sequenceColumn = csvColumn(fields, "stop_sequence");
+                if (tripColumn == -1 || arrivalColumn == -1 || departureColumn == -1 || stopColumn == -1 || sequenceColumn == -1)
+                {
+                    throw runtime_error(stopTimesPath + ": needs trip_id, arrival_time, departure_time, stop_id and stop_sequence columns");
+                }
+                return true;
+            },
+            [&](const vector<CsvField> &fields, StopTimeRow &row) -> const char *
+            {
+                if (int(fields.size()) <= max(max(tripColumn, stopColumn), max(max(arrivalColumn, departureColumn), sequenceColumn)))
+                {
+                    return "missing fields";
+                }
+                row.tripId = csvText(fields[tripColumn]);
+                row.stopId = csvText(fields[stopColumn]);
+                if (row.tripId.empty() || row.stopId.empty())
+                {
+                    return "empty trip_id or stop_id";
+                }
+                if (!parseCsvInt(fields[sequenceColumn], row.sequence))
+                {
+                    return "stop_sequence is not an integer";
+                }
+                if (!parseGtfsTime(fields[arrivalColumn], row.arrival) || !parseGtfsTime(fields[departureColumn], row.departure))
+                {
+                    return "malformed time";
+                }
+                return nullptr;
+            },
+            [&](const StopTimeRow &row) -> const char *
+            {
+                // A rejected row ends the current run of the trip: rows rejected here
+                // return before previousTrip is set again, rows parse rejected clear it
+                // in the skipped callback below
+                bool sameTrip = row.tripId == previousTrip;
+                previousTrip.clear();
+                if (!sameTrip)
+                {
+                    trip = -1;
+                }
+                auto stop = ids.find(row.stopId);
+                if (stop == ids.end())
+                {
+                    return "unknown stop_id";
+                }
+                if (sameTrip && row.sequence <= previousSequence)
+                {
+                    return "stop_sequence out of order";
+                }
+                if (sameTrip && row.arrival != -1 && previousDeparture != -1 && row.arrival < previousDeparture)
+                {
+                    return "arrival before the previous departure";
+                }
+                if (sameTrip && previousStop != stop->second)
+                {
+                    uint64_t key = (uint64_t(uint32_t(previousStop)) << 32) | uint32_t(stop->second);
+                    if (segments.insert(key).second)
+                    {
+                        int minutes = Dlower;
+                        if (row.arrival != -1 && previousDeparture != -1)
+                        {
+                            minutes = max(1, (row.arrival - previousDeparture + 59) / 60);
+                        }
+                        addEdge(previousStop, stop->second, minutes, Tlower, RLlower);
+                    }
+                    if (row.arrival != -1 && previousDeparture != -1)
+                    {
+                        if (trip == -1)
+                        {
+                            trip = addTrip();
+                        }
+                        addConnection(trip, previousStop, stop->second, previousDeparture, row.arrival);
+                        ++stats.connectionsAdded;
+                    }
+                }
+                previousTrip = row.tripId;
+                previousStop = stop->second;
+                previousSequence = row.sequence;
+                previousDeparture = row.departure != -1 ? row.departure : row.arrival;
+                return nullptr;
+            },
+            [&]()
+            {
+                previousTrip.clear();
+            });
+
+        stats.rowsRead += times.rowsRead;
+        stats.rowsImported += times.rowsImported;
+        stats.rowsRejected += times.rowsRejected;
+        stats.edgesAdded = segments.size();
+        stats.seconds += times.seconds;
+        for (const string &error : times.errors)
+        {
+            if (stats.errors.size() < ImportStats::maxErrors)
+            {
+                stats.errors.push_back(error);
+            }
+        }
+        if (stopIds)
+        {
+            stopIds->swap(ids);
+        }
+        return stats;
+    }
+
+    // Scheduled services. A trip is one run of a vehicle; its connections (node ids,
+    // seconds after midnight) must be added in the order it runs. Connections between
+    // unknown nodes are ignored, like edges.
+    int addTrip() { return timetable.addTrip(); }
+
+    void addConnection(int trip, int source, int destination, int departure, int arrival)
+    {
+        if (trip < 0 || trip >= timetable.tripCount)
+        {
+            throw logic_error("addConnection: unknown trip " + to_string(trip));
+        }
+        if (arrival < departure)
+        {
+            throw logic_error("addConnection: arrival before departure");
+        }
+        int from = nodeIndex.find(source);
+        int to = nodeIndex.find(destination);
+        if (from != -1 && to != -1)
+        {
+            timetable.addConnection(Connection{from, to, departure, arrival, trip});
+        }
+    }
+
+    // Walk of the given length between two stops, usable when changing vehicles
+    void addFootpath(int source, int destination, int seconds)
+    {
+        if (seconds < 0)
+        {
+            throw logic_error("addFootpath: negative duration");
+        }
+        int from = nodeIndex.find(source);
+        int to = nodeIndex.find(destination);
+        if (from != -1 && to != -1)
+        {
+            timetable.addFootpath(from, to, seconds);
+        }
+    }
+
+    size_t connectionCount() const { return timetable.connectionCount(); }
+
+    // Earliest arrival at end when leaving start at departure (seconds after midnight),
+    // over the connections and footpaths of the timetable, by Connection Scan.
+    // journey.arrival is -1 when end cannot be reached that day.
+    Journey earliestArrival(int start, int end, int departure)
+    {
+        PROFILE_SCOPE("earliestArrival");
+        int source = nodeIndex.find(start);
+        int target = nodeIndex.find(end);
+        if (source == -1 || target == -1)
+        {
+            return Journey();
+        }
+        const CompactCityGraph &graph = compact();
+        Journey journey = timetable.earliestArrival(source, target, departure, graph.nodeCount());
+        for (JourneyLeg &leg : journey.legs)
+        {
+            leg.from = graph.nodeIds[leg.from];
+            leg.to = graph.nodeIds[leg.to];
+        }
+        return journey;
+    }
+
+    // Answer many origin/destination queries at once. Queries sharing an origin are
+    // grouped into one Dijkstra that stops when all of the group's destinations are
+    // settled; groups are spread over a thread pool, each worker reusing its own
+    // search workspace. results[i] answers queries[i].
+    vector<RouteResult> solveBatch(const pair<int, int> *queries, size_t count, ThreadPool &pool)
+    {
+        PROFILE_SCOPE("solveBatch");
+        const CompactCityGraph &graph = compact();
+        vector<RouteResult> results(count);
+
+        // (source index, query number), sorted so each origin forms one run
+        vector<pair<int, int>> order;
+        order.reserve(count);
+        for (size_t q = 0; q < count; ++q)
+        {
+            int source = nodeIndex.find(queries[q].first);
+            if (source != -1 && nodeIndex.find(queries[q].second) != -1)
+            {
+                order.push_back(make_pair(source, int(q)));
+            }
+        }
+        sort(order.begin(), order.end());
+
+        vector<SearchWorkspace> workspaces(pool.size());
+        const size_t queriesPerTask = 64;
+        size_t groupStart = 0;
+        while (groupStart < order.size())
+        {
+            // Whole origin groups, at least queriesPerTask queries per task
+            size_t taskEnd = groupStart;
+            while (taskEnd < order.size() && (taskEnd - groupStart < queriesPerTask || order[taskEnd].first == order[taskEnd - 1].first))
+            {
+                ++taskEnd;
+            }
+            pool.submit([this, &graph, &order, &results, &workspaces, &pool, queries, groupStart, taskEnd]()
+                        {
+                            SearchWorkspace &work = workspaces[pool.workerIndex()];
+                            size_t first = groupStart;
+                            while (first < taskEnd)
+                            {
+                                size_t last = first;
+                                while (last < taskEnd && order[last].first == order[first].first)
+                                {
+                                    ++last;
+                                }
+                                solveGroup(graph, queries, order, first, last, work, results);
+                                first = last;
+                            }
+                        });
+            groupStart = taskEnd;
+        }
+        pool.wait();
+        return results;
+    }
+
+    vector<RouteResult> solveBatch(const vector<pair<int, int>> &queries, int threadCount = thread::hardware_concurrency())
+    {
+        ThreadPool pool(threadCount);
+        return solveBatch(queries.data(), queries.size(), pool);
+    }
+
+    // Cost of the most convenient path from every origin to every destination, for
+    // dispatching many vehicles to many riders at once. With withPaths the matrix also
+    // keeps what matrixPath needs to build any cell's path later, which costs far less
+    // than unpacking every path up front. The matrix is read from a precomputed route
+    // table, computed with buckets over a contraction hierarchy, or else by one search
+    // per origin on the pool. Unknown ids give rows or columns of infinity.
+    CostMatrix costMatrix(const vector<int> &origins, const vector<int> &destinations, ThreadPool &pool, bool withPaths = false)
+    {
+        PROFILE_SCOPE("costMatrix");
+        CostMatrix matrix;
+        matrix.rows = origins.size();
+        matrix.columns = destinations.size();
+        matrix.costs.assign(matrix.rows * matrix.columns, numeric_limits<double>::infinity());
+        matrix.withPaths = withPaths;
+        vector<int> &sources = matrix.sources;
+        vector<int> &targets = matrix.targets;
+        for (int id : origins)
+        {
+            sources.push_back(nodeIndex.find(id));
+        }
+        for (int id : destinations)
+        {
+            targets.push_back(nodeIndex.find(id));
+        }
+
+        if (hasRouteTable())
+        {
+            matrix.source = RouteTableSource;
+            for (size_t row = 0; row < sources.size(); ++row)
+            {
+                for (size_t column = 0; column < targets.size() && sources[row] != -1; ++column)
+                {
+                    if (targets[column] != -1)
+                    {
+                        matrix.costs[row * targets.size() + column] = routeTable->cost[size_t(sources[row]) * routeTable->nodeCount + targets[column]];
+                    }
+                }
+            }
+        }
+        else if (hasContractionHierarchy())
+        {
+            matrix.source = HierarchySource;
+            if (withPaths)
+            {
+                matrix.meeting.assign(matrix.rows * matrix.columns, -1);
+                matrix.upwardSpaces.resize(matrix.rows);
+                matrix.downwardSpaces.resize(matrix.columns);
+            }
+            hierarchyMatrix(sources, targets, withPaths, pool, matrix);
+        }
+        else
+        {
+            matrix.source = SearchSource;
+            if (withPaths)
+            {
+                matrix.searchTrees.resize(matrix.rows);
+            }
+            searchMatrix(sources, targets, withPaths, pool, matrix);
+        }
+        matrix.version = version;
+        return matrix;
+    }
+
+    // Node ids of the path of one cell of a matrix computed here with withPaths, built
+    // now from what the matrix kept; empty when the cell has no path. The graph must
+    // not have changed since the matrix was computed.
+    vector<int> matrixPath(const CostMatrix &matrix, size_t row, size_t column)
+    {
+        if (!matrix.withPaths || matrix.version != version)
+        {
+            throw logic_error("matrixPath: matrix computed without paths or for an older graph version");
+        }
+        if (matrix.at(row, column) == numeric_limits<double>::infinity())
+        {
+            return vector<int>();
+        }
+        const CompactCityGraph &graph = compact();
+        int source = matrix.sources[row];
+        int target = matrix.targets[column];
+        EdgePath path;
+        path.start = source;
+        if (matrix.source == RouteTableSource)
+        {
+            path = routeTable->route(graph, source, target);
+        }
+        else if (matrix.source == HierarchySource)
+        {
+            // Up from the origin to the meeting node, then down to the destination
+            const ContractionHierarchy &ch = *hierarchy;
+            int meeting = matrix.meeting[row * matrix.columns + column];
+            const vector<pair<int, int>> &upward = matrix.upwardSpaces[row];
+            vector<int> arcs;
+            for (int v = meeting; v != source;)
+            {
+                int arc = lower_bound(upward.begin(), upward.end(), make_pair(v, numeric_limits<int>::min()))->second;
+                arcs.push_back(arc);
+                v = ch.arcs[arc].from;
+            }
+            for (size_t i = arcs.size(); i-- > 0;)
+            {
+                ch.unpack(arcs[i], path.edges);
+            }
+            const vector<pair<int, int>> &downward = matrix.downwardSpaces[column];
+            for (int v = meeting; v != target;)
+            {
+                int arc = lower_bound(downward.begin(), downward.end(), make_pair(v, numeric_limits<int>::min()))->second;
+                ch.unpack(arc, path.edges);
+                v = ch.arcs[arc].to;
+            }
+        }
+        else
+        {
+            const vector<pair<int, int>> &tree = matrix.searchTrees[row];
+            for (int v = target; v != source;)
+            {
+                int edge = lower_bound(tree.begin(), tree.end(), make_pair(v, numeric_limits<int>::min()))->second;
+                path.edges.push_back(edge);
+                v = graph.edgeSource(edge);
+            }
+            reverse(path.edges.begin(), path.edges.end());
+        }
+        return graph.nodePath(path);
+    }
+
+    CostMatrix costMatrix(const vector<int> &origins, const vector<int> &destinations, bool withPaths = false, int threadCount = thread::hardware_concurrency())
+    {
+        ThreadPool pool(threadCount);
+        return costMatrix(origins, destinations, pool, withPaths);
+    }
+
+    // Thread-safe best-path query on the latest published snapshot
+    vector<int> findBestPathConcurrent(int start, int end) const
+    {
+        SnapshotReader reader = readSnapshot();
+        return reader.get() ? reader->findBestPath(start, end) : vector<int>();
+    }
+
+    // Apply a batch of live traffic / red light values. Every edge from source to
+    // destination takes the new values; unknown node pairs are ignored. The CSR
+    // columns are patched in place, the graph version moves on (so cached results
+    // are not served again) and a precomputed route table is repaired incrementally
+    // instead of being rebuilt, unless the batch touches so many edges that a rebuild
+    // is cheaper. Returns the number of edges whose cost changed.
+    size_t updateTraffic(const vector<EdgeUpdate> &updates, int threadCount = thread::hardware_concurrency())
+    {
+        bool tableWasValid = hasRouteTable();
+        compact();
+        CompactCityGraph &graph = compactGraph;
+        vector<EdgeChange> changes;
+        for (const EdgeUpdate &update : updates)
+        {
+            CityNode *source = findNode(update.source);
+            CityNode *destination = findNode(update.destination);
+            if (!source || !destination)
+            {
+                continue;
+            }
+            for (size_t i = 0; i < source->edges.size(); ++i)
+            {
+                CityEdge *edge = source->edges[i];
+                if (edge->destination != destination)
+                {
+                    continue;
+                }
+                double oldCost = edge->cost;
+                edge->setInfo(EdgeInfo(edge->info.distance, update.traffic, update.redLight));
+                int slot = graph.offsets[source->index] + i;
+                graph.traffic[slot] = update.traffic;
+                graph.redLight[slot] = update.redLight;
+                graph.cost[slot] = edge->cost;
+                if (edge->cost != oldCost)
+                {
+                    EdgeChange change = {slot, oldCost, edge->cost};
+                    changes.push_back(change);
+                }
+            }
+        }
+        if (changes.empty())
+        {
+            return 0;
+        }
+
+        // A slot changed twice in one batch keeps its first old cost and last new cost
+        sort(changes.begin(), changes.end(), [](const EdgeChange &a, const EdgeChange &b)
+             { return a.edge < b.edge; });
+        vector<EdgeChange> merged;
+        for (const EdgeChange &change : changes)
+        {
+            if (!merged.empty() && merged.back().edge == change.edge)
+            {
+                merged.back().newCost = change.newCost;
+            }
+            else
+            {
+                merged.push_back(change);
+            }
+        }
+
+        ++version;
+        if (tableWasValid && merged.size() * 16 > size_t(graph.edgeCount()))
+        {
+            // Past a few percent of the edges a rebuild is cheaper than repairing
+            precomputeRoutes(AutoAllPairs, threadCount);
+        }
+        else if (tableWasValid)
+        {
+            ThreadPool pool(threadCount);
+            routeTable->repair(graph, reverseTopology(), reverseSlots, merged, pool);
+            routeTable->version = version;
+        }
+        if (snapshots.hasSnapshot())
+        {
+            publish();
+        }
+        return merged.size();
+    }
+
+    // Most convenient route as CSR edge slots: served from the LRU cache when the same
+    // query was answered for the current graph version, otherwise a table lookup when
+    // routes are precomputed, a contraction hierarchy query when one is built, an A*
+    // search when landmarks are, or a Dijkstra search
+    EdgePath findRouteEdges(int start, int end)
+    {
+        PROFILE_SCOPE("findRoute");
+        int startIndex = nodeIndex.find(start);
+        int endIndex = nodeIndex.find(end);
+        if (startIndex == -1 || endIndex == -1 || !reachabilityIndex().mayReach(startIndex, endIndex))
+        {
+            return EdgePath();
+        }
+
+        RouteKey key = {start, end, version};
+        CachedRoute cached;
+        if (routeCache.lookup(key, cached))
+        {
+            return cached.path;
+        }
+        if (hasRouteTable())
+        {
+            cached.path = routeTable->route(compact(), startIndex, endIndex);
+        }
+        else if (hasContractionHierarchy())
+        {
+            hierarchy->query(startIndex, endIndex, forwardSearch, backwardSearch, cached.path);
+        }
+        else if (hasLandmarks())
+        {
+            SearchStats stats;
+            cached.path = findBestEdgePathAStar(start, end, stats);
+        }
+        else
+        {
+            cached.path = findBestEdgePath(start, end);
+        }
+        if (cached.path.start != -1)
+        {
+            cached.cost = compact().pathCost(cached.path);
+        }
+        routeCache.insert(key, cached);
+        return cached.path;
+    }
+
+    void setRouteCacheCapacity(size_t capacity) { routeCache.setCapacity(capacity); }
+    RouteCacheStats routeCacheStats() { return routeCache.stats(); }
+
+    vector<int> findRoute(int start, int end)
+    {
+        EdgePath path = findRouteEdges(start, end);
+        return path.start == -1 ? vector<int>() : compact().nodePath(path);
+    }
+
+    // Print only the most convenient path between two nodes
+    void showBestPath(int start, int end)
+    {
+        EdgePath bestPath = findRouteEdges(start, end);
+        if (bestPath.start == -1)
+        {
+            cout << "No paths found." << endl;
+            return;
+        }
+        cout << "Most convenient path: ";
+        displayPath(compact().nodePath(bestPath));
+        cout << "convenient score  " << compact().pathCost(bestPath) << endl;
+    }
+
+    // Print the k most convenient loopless paths between two nodes
+    void showBestPaths(int start, int end, size_t k)
+    {
+        vector<pair<double, vector<int>>> paths = kBestPaths(start, end, k);
+        if (paths.empty())
+        {
+            cout << "No paths found." << endl;
+            return;
+        }
+        for (size_t i = 0; i < paths.size(); ++i)
+        {
+            cout << i + 1 << ". ";
+            displayPath(paths[i].second);
+            cout << "   convenient score  " << paths[i].first << endl;
+        }
+    }
+
+    // Display the graph
+    void displayGraph()
+    {
+        const CompactCityGraph &graph = compact();
+        for (int i = 1; i <= Totalnode ; ++i)
+        {
+            cout << "+------";
+        }
+        cout << "+" << endl;
+
+        for (int i = 1; i <= Totalnode; ++i)
+        {
+            int node = nodeIndex.find(i);
+            if (node != -1)
+            {
+                cout << "| " << nodeType(node)[0] << i << "  ";
+            }
+            else
+            {
+                cout << "| ";
+            }
+        }
+        cout << "|" << endl;
+
+        for (int i = 1; i <= Totalnode; ++i)
+        {
+            cout << "+------";
+        }
+        cout << "+" << endl;
+
+        cout << endl
+             << endl;
+
+        for (int i = 1; i <= Totalnode; ++i)
+        {
+            int node = nodeIndex.find(i);
+            if (node != -1)
+            {
+                for (int e = graph.offsets[node]; e < graph.offsets[node + 1]; ++e)
+                {
+                    cout << nodeType(node)[0] << i << " --> ";
+
+                    int destination = graph.targets[e];
+                    cout << nodeType(destination)[0] << graph.nodeIds[destination] << " (D: " << graph.distance[e]
+                         << ", T: " << graph.traffic[e] << ", RL: " << graph.redLight[e] << ") ";
+
+                    cout << endl;
+                }
+                cout << endl;
+            }
+            else
+            {
+                cout << "                 " << endl;
+            }
+        }
+
+        for (int i = 1; i <= Totalnode; ++i)
+        {
+            cout << "+-----------------";
+        }
+        cout << "+" << endl;
+    }
+};
+
+// Engine behind generateRandomNumber: seeded from random_device unless
+// seedRandomNumbers was called, so a run can be repeated exactly, with any standard
+// library: like generateCity, numbers are drawn with plain modulo from mt19937
+mt19937 &randomEngine()
+{
+    static mt19937 gen(random_device{}());
+    return gen;
+}
+
+void seedRandomNumbers(unsigned seed)
+{
+    randomEngine().seed(seed);
+}
+
+int generateRandomNumber(int lower, int upper)
+{
+    return lower + int(randomEngine()() % uint32_t(upper - lower + 1));
+}
+
+void createCity(CityGraph &city)
+{
+
+    city.addEdge(1, 2, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
+    city.addEdge(2, 1, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
+    city.addEdge(1, 5, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
+    city.addEdge(2, 5, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
+    city.addEdge(2, 4, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
+    city.addEdge(3, 4, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
+    city.addEdge(3, 6, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
+    city.addEdge(4, 3, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
+    city.addEdge(4 ,6, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
+    city.addEdge(5, 2, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
+    city.addEdge(5, 3, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
+    city.addEdge(6, 5, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
+    city.addEdge(6, 4, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
+    city.addEdge(6, 7, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
+    city.addEdge(5,7, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
+    city.addEdge(3,7, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
+    city.addEdge(7,4, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
+    city.addEdge(7,6, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
+    city.addEdge(2,7, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
+
+
+}
+
+
+// Street layouts of generateCity
+enum CityLayout
+{
+    GridCity,           // square grid of blocks
+    RingRadialCity,     // rings around a centre, linked by radial roads
+    RandomGeometricCity // random crossings joined to all neighbours within a radius
+};
+
+const char *const cityLayoutNames[] = {"grid", "ring-radial", "random-geometric"};
+
+// Fill an empty graph with a synthetic city of nodeCount crossings (ids 1..nodeCount)
+// laid out as requested. Nodes get coordinates 10 units per block and a type cycling
+// through bus stop, taxi stand and auto stand; every street is two-way, with weights in
+// the Dlower/Tlower/RLlower ranges drawn for each direction. The same seed always gives
+// the same city: the weights are drawn with plain modulo from mt19937, whose output
+// the standard fixes, rather than through a distribution, whose mapping it does not.
+void generateCity(CityGraph &city, CityLayout layout, int nodeCount, unsigned seed)
+{
+    mt19937 gen(seed);
+    const double pi = acos(-1.0);
+    const char *types[] = {"Bus Stop", "Taxi Stand", "Auto Stand"};
+    auto street = [&](int a, int b)
+    {
+        city.addEdge(a, b, Dlower + gen() % (Dupper - Dlower + 1), Tlower + gen() % (Tupper - Tlower + 1), RLlower + gen() % (RLupper - RLlower + 1));
+        city.addEdge(b, a, Dlower + gen() % (Dupper - Dlower + 1), Tlower + gen() % (Tupper - Tlower + 1), RLlower + gen() % (RLupper - RLlower + 1));
+    };
+
+    if (layout == GridCity)
+    {
+        int side = max(1, int(ceil(sqrt(double(nodeCount)))));
+        for (int i = 0; i < nodeCount; ++i)
+        {
+            city.addNode(i + 1, types[i % 3], i % side * 10.0, i / side * 10.0);
+        }
+        for (int i = 0; i < nodeCount; ++i)
+        {
+            if (i % side + 1 < side && i + 1 < nodeCount)
+            {
+                street(i + 1, i + 2);
+            }
+            if (i + side < nodeCount)
+            {
+                street(i + 1, i + side + 1);
+            }
+        }
+    }
+    else if (layout == RingRadialCity)
+    {
+        // Node 1 is the centre; ring r holds 8r crossings, each joined to its ring
+        // neighbours and to the crossing at the same angle on ring r - 1
+        city.addNode(1, types[0], 0.0, 0.0);
+        int first = 2; // id of the first crossing of the current ring
+        for (int ring = 1; first <= nodeCount; ++ring)
+        {
+            int size = 8 * ring;
+            int count = min(size, nodeCount - first + 1);
+            for (int i = 0; i < count; ++i)
+            {
+                double angle = 2.0 * pi * i / size;
+                city.addNode(first + i, types[(first + i - 1) % 3], ring * 10.0 * cos(angle), ring * 10.0 * sin(angle));
+            }
+            for (int i = 0; i < count; ++i)
+            {
+                if (i + 1 < count)
+                {
+                    street(first + i, first + i + 1);
+                }
+                else if (count == size)
+                {
+                    street(first + i, first); // close the ring
+                }
+                int inner = ring == 1 ? 1 : first - 8 * (ring - 1) + i * (ring - 1) / ring;
+                street(first + i, inner);
+            }
+            first += size;
+        }
+    }
+    else
+    {
+        // Crossings spread at a fixed density, each joined to every other one within
+        // the radius that gives about seven neighbours; a bucket grid of that cell size
+        // keeps the neighbour search linear
+        double side = sqrt(double(nodeCount)) * 10.0;
+        double radius = sqrt(7.0 / pi) * 10.0;
+        int cells = max(1, int(side / radius));
+        double cellSize = side / cells;
+        vector<double> x(nodeCount), y(nodeCount);
+        vector<vector<int>> buckets(size_t(cells) * cells);
+        for (int i = 0; i < nodeCount; ++i)
+        {
+            x[i] = gen() / 4294967296.0 * side;
+            y[i] = gen() / 4294967296.0 * side;
+            city.addNode(i + 1, types[i % 3], x[i], y[i]);
+            int column = min(cells - 1, int(x[i] / cellSize));
+            int row = min(cells - 1, int(y[i] / cellSize));
+            buckets[size_t(row) * cells + column].push_back(i);
+        }
+        for (int i = 0; i < nodeCount; ++i)
+        {
+            int column = min(cells - 1, int(x[i] / cellSize));
+            int row = min(cells - 1, int(y[i] / cellSize));
+            for (int r = max(0, row - 1); r <= min(cells - 1, row + 1); ++r)
+            {
+                for (int c = max(0, column - 1); c <= min(cells - 1, column + 1); ++c)
+                {
+                    for (int j : buckets[size_t(r) * cells + c])
+                    {
+                        if (j > i && hypot(x[i] - x[j], y[i] - y[j]) <= radius)
+                        {
+                            street(i + 1, j + 1);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Benchmarks (run with: ./main bench <name> [arguments])
+// ---------------------------------------------------------------------------
+
+double secondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Approximate heap footprint of a single allocation (glibc chunk header + 16 byte rounding)
+size_t heapBlockBytes(size_t requested)
+{
+    size_t bytes = (requested + sizeof(size_t) + 15) & ~size_t(15);
+    return max(bytes, size_t(32));
+}
+
+// Build a random graph directly as CityNode/CityEdge objects, the way CityGraph stores it.
+// Edges are inserted in shuffled order, like a city loaded from an unsorted edge list.
+vector<CityNode *> buildRandomNodes(int nodeCount, int edgesPerNode, unsigned seed)
+{
+    mt19937 gen(seed);
+    uniform_int_distribution<int> pickNode(0, nodeCount - 1);
+    uniform_int_distribution<int> pickDistance(Dlower, Dupper);
+    uniform_int_distribution<int> pickTraffic(Tlower, Tupper);
+    uniform_int_distribution<int> pickRedLight(RLlower, RLupper);
+
+    vector<CityNode *> nodes;
+    nodes.reserve(nodeCount);
+    for (int i = 0; i < nodeCount; ++i)
+    {
+        nodes.push_back(new CityNode(i + 1, "Bus Stop"));
+        nodes.back()->index = i;
+    }
+
+    vector<pair<int, int>> edgeList;
+    edgeList.reserve(size_t(nodeCount) * edgesPerNode);
+    for (int i = 0; i < nodeCount; ++i)
+    {
+        for (int k = 0; k < edgesPerNode; ++k)
+        {
+            edgeList.push_back(make_pair(i, pickNode(gen)));
+        }
+    }
+    shuffle(edgeList.begin(), edgeList.end(), gen);
+
+    for (const auto &edge : edgeList)
+    {
+        CityNode *source = nodes[edge.first];
+        EdgeInfo info(pickDistance(gen), pickTraffic(gen), pickRedLight(gen));
+        source->edges.push_back(new CityEdge(source, nodes[edge.second], info));
+    }
+    return nodes;
+}
+
+void deleteNodes(vector<CityNode *> &nodes)
+{
+    for (CityNode *node : nodes)
+    {
+        for (CityEdge *edge : node->edges)
+        {
+            delete edge;
+        }
+        delete node;
+    }
+    nodes.clear();
+}
+
+// Resident set size of the process (0 where /proc is not available)
+size_t residentBytes()
+{
+    ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * 4096;
+}
+
+// Hand freed heap pages back to the system, so the next RSS reading starts clean
+void releaseFreeHeap()
+{
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+}
+
+// The storage of test.cpp: nodes and edges behind shared_ptr, edges pointing back at
+// both of their nodes
+class SharedCityNode;
+
+class SharedCityEdge
+{
+public:
+    shared_ptr<SharedCityNode> source;
+    shared_ptr<SharedCityNode> destination;
+    EdgeInfo info;
+
+    SharedCityEdge(const shared_ptr<SharedCityNode> &_source, const shared_ptr<SharedCityNode> &_destination, const EdgeInfo &_info)
+        : source(_source), destination(_destination), info(_info) {}
+};
+
+class SharedCityNode : public enable_shared_from_this<SharedCityNode>
+{
+public:
+    int id;
+    string type;
+    vector<shared_ptr<SharedCityEdge>> edges;
+
+    SharedCityNode(int _id, const string &_type) : id(_id), type(_type) {}
+
+    void addEdge(const shared_ptr<SharedCityNode> &destination, const EdgeInfo &info)
+    {
+        edges.push_back(make_shared<SharedCityEdge>(shared_from_this(), destination, info));
+    }
+};
+
+// Build, hold and tear down the same graph with a new per node and edge (the old
+// CityGraph), with shared_ptr (test.cpp) and in the graph arena
+void benchmarkArena(int nodeCount, int edgesPerNode)
+{
+    cout << "Arena benchmark: " << nodeCount << " nodes, " << edgesPerNode << " edges per node" << endl;
+    mt19937 gen(5);
+    vector<pair<int, int>> edgeList;
+    edgeList.reserve(size_t(nodeCount) * edgesPerNode);
+    for (int i = 0; i < nodeCount; ++i)
+    {
+        for (int k = 0; k < edgesPerNode; ++k)
+        {
+            edgeList.push_back(make_pair(i, int(gen() % nodeCount)));
+        }
+    }
+    shuffle(edgeList.begin(), edgeList.end(), gen);
+    EdgeInfo info(Dlower, Tlower, RLlower);
+
+    auto report = [](const char *name, double buildSeconds, size_t rssBytes, double teardownSeconds)
+    {
+        cout << "  " << name << "build " << buildSeconds * 1000 << " ms, RSS +" << rssBytes / (1024 * 1024)
+             << " MiB, teardown " << teardownSeconds * 1000 << " ms" << endl;
+    };
+
+    {
+        releaseFreeHeap();
+        size_t rssBefore = residentBytes();
+        auto start = chrono::steady_clock::now();
+        vector<CityNode *> nodes;
+        nodes.reserve(nodeCount);
+        for (int i = 0; i < nodeCount; ++i)
+        {
+            nodes.push_back(new CityNode(i + 1, "Bus Stop"));
+        }
+        for (const auto &edge : edgeList)
+        {
+            nodes[edge.first]->edges.push_back(new CityEdge(nodes[edge.first], nodes[edge.second], info));
+        }
+        double buildSeconds = secondsSince(start);
+        size_t rss = residentBytes() - rssBefore;
+        start = chrono::steady_clock::now();
+        deleteNodes(nodes);
+        report("new per element: ", buildSeconds, rss, secondsSince(start));
+    }
+
+    {
+        releaseFreeHeap();
+        size_t rssBefore = residentBytes();
+        auto start = chrono::steady_clock::now();
+        vector<shared_ptr<SharedCityNode>> nodes;
+        nodes.reserve(nodeCount);
+        for (int i = 0; i < nodeCount; ++i)
+        {
+            nodes.push_back(make_shared<SharedCityNode>(i + 1, "Bus Stop"));
+        }
+        for (const auto &edge : edgeList)
+        {
+            nodes[edge.first]->addEdge(nodes[edge.second], info);
+        }
+        double buildSeconds = secondsSince(start);
+        size_t rss = residentBytes() - rssBefore;
+        start = chrono::steady_clock::now();
+        // Edges own their nodes too, so the cycles have to be cut by hand
+        for (auto &node : nodes)
+        {
+            node->edges.clear();
+        }
+        nodes.clear();
+        report("shared_ptr:      ", buildSeconds, rss, secondsSince(start));
+    }
+
+    {
+        releaseFreeHeap();
+        size_t rssBefore = residentBytes();
+        auto start = chrono::steady_clock::now();
+        CityGraph *graph = new CityGraph();
+        for (int i = 0; i < nodeCount; ++i)
+        {
+            graph->addNode(i + 1, "Bus Stop");
+        }
+        for (const auto &edge : edgeList)
+        {
+            graph->addEdge(edge.first + 1, edge.second + 1, Dlower, Tlower, RLlower);
+        }
+        double buildSeconds = secondsSince(start);
+        size_t rss = residentBytes() - rssBefore;
+        size_t storage = graph->storageBytes();
+        size_t inUse = graph->storageBytesInUse();
+        start = chrono::steady_clock::now();
+        delete graph;
+        report("CityGraph arena: ", buildSeconds, rss, secondsSince(start));
+        cout << "  arena storage: " << storage << " bytes reserved, " << inUse << " in use ("
+             << double(storage) / edgeList.size() << " bytes/edge)" << endl;
+    }
+}
+
+// Nodes settled per query and latency of plain Dijkstra against the bidirectional
+// searches of findBestPathAStar, on a grid whose nodes carry coordinates
+void benchmarkAStar(int side, int queryCount)
+{
+    int nodeCount = side * side;
+    cout << "A* benchmark: " << side << " x " << side << " grid, " << queryCount << " queries" << endl;
+    CityGraph graph;
+    for (int i = 0; i < nodeCount; ++i)
+    {
+        graph.addNode(i + 1, "Bus Stop", i % side * 10.0, i / side * 10.0);
+    }
+    mt19937 gen(31);
+    auto street = [&](int a, int b)
+    {
+        graph.addEdge(a, b, Dlower + gen() % (Dupper - Dlower + 1), Tlower + gen() % (Tupper - Tlower + 1), RLlower + gen() % (RLupper - RLlower + 1));
+        graph.addEdge(b, a, Dlower + gen() % (Dupper - Dlower + 1), Tlower + gen() % (Tupper - Tlower + 1), RLlower + gen() % (RLupper - RLlower + 1));
+    };
+    for (int row = 0; row < side; ++row)
+    {
+        for (int column = 0; column < side; ++column)
+        {
+            int node = row * side + column + 1;
+            if (column + 1 < side)
+            {
+                street(node, node + 1);
+            }
+            if (row + 1 < side)
+            {
+                street(node, node + side);
+            }
+        }
+    }
+
+    auto start = chrono::steady_clock::now();
+    graph.precomputeLandmarks();
+    double landmarkSeconds = secondsSince(start);
+    cout << "  landmarks: " << landmarkSeconds * 1000 << " ms, "
+         << graph.landmarkIndex()->memoryBytes() / (1024.0 * 1024.0) << " MiB" << endl;
+
+    vector<pair<int, int>> queries;
+    for (int q = 0; q < queryCount; ++q)
+    {
+        queries.push_back(make_pair(1 + gen() % nodeCount, 1 + gen() % nodeCount));
+    }
+
+    SearchStats dijkstraStats;
+    vector<double> expected;
+    start = chrono::steady_clock::now();
+    for (const auto &query : queries)
+    {
+        expected.push_back(graph.calculateConvenienceScore(graph.findBestPath(query.first, query.second, &dijkstraStats)));
+    }
+    double dijkstraSeconds = secondsSince(start);
+    cout << "  Dijkstra:               " << dijkstraStats.nodesExpanded / queryCount << " nodes settled/query, "
+         << dijkstraSeconds / queryCount * 1e6 << " us" << endl;
+
+    const char *names[] = {"bidirectional Dijkstra: ", "A* geometric bound:     ", "A* landmarks (ALT):     ", "A* combined:            "};
+    for (int mode = NoHeuristic; mode <= CombinedHeuristic; ++mode)
+    {
+        SearchStats stats;
+        int mismatches = 0;
+        start = chrono::steady_clock::now();
+        for (size_t q = 0; q < queries.size(); ++q)
+        {
+            vector<int> path = graph.findBestPathAStar(queries[q].first, queries[q].second, stats, HeuristicMode(mode));
+            mismatches += fabs(graph.calculateConvenienceScore(path) - expected[q]) > 1e-9;
+        }
+        double seconds = secondsSince(start);
+        cout << "  " << names[mode] << stats.nodesExpanded / queryCount << " nodes settled/query, "
+             << seconds / queryCount * 1e6 << " us, " << mismatches << " mismatches" << endl;
+    }
+}
+
+// Earliest-arrival queries over a synthetic metro timetable: lines of 30 random stops
+// run both ways every ten minutes from 5:00 to midnight, and neighbouring stop ids are
+// linked by five-minute walks
+void benchmarkTransit(int stopCount, int lineCount, int queryCount)
+{
+    cout << "Transit benchmark: " << stopCount << " stops, " << lineCount << " lines, " << queryCount << " queries" << endl;
+    CityGraph graph;
+    for (int i = 1; i <= stopCount; ++i)
+    {
+        graph.addNode(i, "Bus Stop");
+    }
+    for (int i = 1; i < stopCount; ++i)
+    {
+        graph.addFootpath(i, i + 1, 300);
+        graph.addFootpath(i + 1, i, 300);
+    }
+    mt19937 gen(37);
+    const int stopsPerLine = 30;
+    for (int line = 0; line < lineCount; ++line)
+    {
+        vector<int> stops;
+        vector<int> hopSeconds;
+        for (int i = 0; i < stopsPerLine; ++i)
+        {
+            stops.push_back(1 + gen() % stopCount);
+            hopSeconds.push_back(90 + gen() % 120);
+        }
+        for (int direction = 0; direction < 2; ++direction)
+        {
+            for (int start = 5 * 3600; start < 24 * 3600; start += 600)
+            {
+                int trip = graph.addTrip();
+                int time = start;
+                for (int i = 0; i + 1 < stopsPerLine; ++i)
+                {
+                    graph.addConnection(trip, stops[i], stops[i + 1], time, time + hopSeconds[i]);
+                    time += hopSeconds[i] + 30; // dwell at the stop
+                }
+            }
+            reverse(stops.begin(), stops.end());
+            reverse(hopSeconds.begin(), hopSeconds.end() - 1);
+        }
+    }
+    cout << "  connections: " << graph.connectionCount() << endl;
+
+    auto start = chrono::steady_clock::now();
+    graph.earliestArrival(1, 1, 0); // sorts the timetable
+    cout << "  preparation: " << secondsSince(start) * 1000 << " ms" << endl;
+
+    vector<pair<int, int>> queries;
+    vector<int> departures;
+    for (int q = 0; q < queryCount; ++q)
+    {
+        queries.push_back(make_pair(1 + gen() % stopCount, 1 + gen() % stopCount));
+        departures.push_back(6 * 3600 + gen() % (14 * 3600));
+    }
+    size_t scanned = 0;
+    int reached = 0;
+    double travelMinutes = 0.0;
+    start = chrono::steady_clock::now();
+    for (int q = 0; q < queryCount; ++q)
+    {
+        Journey journey = graph.earliestArrival(queries[q].first, queries[q].second, departures[q]);
+        scanned += journey.connectionsScanned;
+        if (journey.arrival != -1)
+        {
+            ++reached;
+            travelMinutes += (journey.arrival - departures[q]) / 60.0;
+        }
+    }
+    double seconds = secondsSince(start);
+    cout << "  query: " << seconds / queryCount * 1000 << " ms, " << scanned / queryCount << " connections scanned, "
+         << reached << " reached, " << (reached ? travelMinutes / reached : 0.0) << " min average travel time" << endl;
+}
+
+// Multimodal queries on the implicit (node, mode) product against the same search on a
+// materialized copy of the product graph, which also checks the answers
+int benchmarkMultimodal(int nodeCount, int edgesPerNode, int queryCount)
+{
+    cout << "Multimodal benchmark: " << nodeCount << " nodes, " << edgesPerNode << " edges/node, " << queryCount << " queries" << endl;
+    const char *types[] = {"Bus Stop", "Taxi Stand", "Auto Stand"};
+    CityGraph graph;
+    for (int i = 0; i < nodeCount; ++i)
+    {
+        graph.addNode(i + 1, types[i % 3]);
+    }
+    mt19937 gen(41);
+    for (int i = 1; i <= nodeCount; ++i)
+    {
+        for (int k = 0; k < edgesPerNode; ++k)
+        {
+            int j = 1 + gen() % nodeCount;
+            graph.addEdge(i, j, Dlower + gen() % (Dupper - Dlower + 1), Tlower + gen() % (Tupper - Tlower + 1), RLlower + gen() % (RLupper - RLlower + 1));
+        }
+    }
+    ModeProfile profile;
+    profile.costFactor[BusMode] = 1.0;
+    profile.costFactor[TaxiMode] = 0.6;
+    profile.costFactor[AutoMode] = 0.8;
+
+    // The product graph written out: three copies of every edge plus the changes of vehicle
+    CompactCityGraph product;
+    graph.publish();
+    SnapshotReader reader = graph.readSnapshot();
+    const CompactCityGraph &base = reader->graph;
+    product.nodeIds.resize(nodeCount * TravelModeCount);
+    for (int state = 0; state < nodeCount * TravelModeCount; ++state)
+    {
+        int v = state / TravelModeCount;
+        int mode = state % TravelModeCount;
+        product.nodeIds[state] = state;
+        for (int e = base.offsets[v]; e < base.offsets[v + 1]; ++e)
+        {
+            product.targets.push_back(base.targets[e] * TravelModeCount + mode);
+            product.cost.push_back(profile.costFactor[mode] * base.cost[e]);
+        }
+        for (int other = 0; other < TravelModeCount; ++other)
+        {
+            double penalty = profile.boardingPenalty(types[v % 3], TravelMode(other));
+            if (other != mode && penalty < numeric_limits<double>::infinity())
+            {
+                product.targets.push_back(v * TravelModeCount + other);
+                product.cost.push_back(penalty);
+            }
+        }
+        product.offsets.push_back(product.targets.size());
+    }
+    size_t productBytes = (product.offsets.capacity() + product.targets.capacity()) * sizeof(int) + product.cost.capacity() * sizeof(double);
+    cout << "  base CSR:             " << base.memoryBytes() / (1024.0 * 1024.0) << " MiB" << endl;
+    cout << "  materialized product: " << productBytes / (1024.0 * 1024.0) << " MiB" << endl;
+    cout << "  implicit labels:      " << nodeCount * TravelModeCount * (sizeof(double) + 2 * sizeof(int)) / (1024.0 * 1024.0) << " MiB" << endl;
+
+    vector<pair<int, int>> queries;
+    for (int q = 0; q < queryCount; ++q)
+    {
+        queries.push_back(make_pair(1 + gen() % nodeCount, 1 + gen() % nodeCount));
+    }
+    SearchStats stats;
+    vector<double> costs;
+    auto start = chrono::steady_clock::now();
+    for (const auto &query : queries)
+    {
+        costs.push_back(graph.findMultimodalRoute(query.first, query.second, profile, &stats).cost);
+    }
+    double implicitSeconds = secondsSince(start);
+
+    int mismatches = 0;
+    int changes = 0;
+    ShortestPathTree tree;
+    start = chrono::steady_clock::now();
+    for (size_t q = 0; q < queries.size(); ++q)
+    {
+        // Every node type offers one mode, so each query has a single start state
+        int source = queries[q].first - 1;
+        int target = queries[q].second - 1;
+        tree.build(product, source * TravelModeCount + source % 3);
+        double best = numeric_limits<double>::infinity();
+        for (int mode = 0; mode < TravelModeCount; ++mode)
+        {
+            best = min(best, tree.cost[target * TravelModeCount + mode]);
+        }
+        best += profile.boardingPenalty(types[source % 3], TravelMode(source % 3));
+        mismatches += !(fabs(best - costs[q]) <= 1e-9 || best == costs[q]);
+    }
+    double materializedSeconds = secondsSince(start);
+    for (const auto &query : queries)
+    {
+        MultimodalRoute route = graph.findMultimodalRoute(query.first, query.second, profile);
+        for (size_t i = 1; i < route.edgeModes.size(); ++i)
+        {
+            changes += route.edgeModes[i] != route.edgeModes[i - 1];
+        }
+    }
+    cout << "  implicit query:       " << implicitSeconds / queryCount * 1000 << " ms, " << stats.nodesExpanded / queryCount
+         << " states settled, " << double(changes) / queryCount << " vehicle changes/route" << endl;
+    cout << "  materialized check:   " << materializedSeconds / queryCount * 1000 << " ms (full tree), " << mismatches << " mismatches" << endl;
+
+    // Brute-force reference on small graphs: Bellman-Ford over (node, mode) states taken
+    // straight from the edges as they were added, with random node types, cost factors,
+    // penalties and forbidden boardings, from every start to every target
+    const int smallNodes = 12;
+    const double infinity = numeric_limits<double>::infinity();
+    int bruteForceQueries = 0;
+    int bruteForceMismatches = 0;
+    for (int round = 0; round < 30; ++round)
+    {
+        CityGraph small;
+        vector<int> smallTypes(smallNodes);
+        for (int v = 0; v < smallNodes; ++v)
+        {
+            smallTypes[v] = gen() % 3;
+            small.addNode(v + 1, types[smallTypes[v]]);
+        }
+        vector<pair<pair<int, int>, double>> edges; // ((from, to), convenience cost)
+        for (int k = 0; k < 3 * smallNodes; ++k)
+        {
+            int from = gen() % smallNodes;
+            int to = gen() % smallNodes;
+            int distance = Dlower + gen() % (Dupper - Dlower + 1);
+            int traffic = Tlower + gen() % (Tupper - Tlower + 1);
+            int redLight = RLlower + gen() % (RLupper - RLlower + 1);
+            small.addEdge(from + 1, to + 1, distance, traffic, redLight);
+            edges.push_back(make_pair(make_pair(from, to), convenienceCost(distance, traffic, redLight)));
+        }
+        ModeProfile rules(gen() % 20 / 10.0);
+        for (int mode = 0; mode < TravelModeCount; ++mode)
+        {
+            rules.costFactor[mode] = (1 + gen() % 15) / 10.0;
+        }
+        rules.allowBoarding(types[gen() % 3], TravelMode(gen() % TravelModeCount), gen() % 20 / 10.0);
+        rules.forbidBoarding(types[gen() % 3], TravelMode(gen() % TravelModeCount));
+
+        for (int source = 0; source < smallNodes; ++source)
+        {
+            vector<double> cost(smallNodes * TravelModeCount, infinity);
+            for (int mode = 0; mode < TravelModeCount; ++mode)
+            {
+                cost[source * TravelModeCount + mode] = rules.boardingPenalty(types[smallTypes[source]], TravelMode(mode));
+            }
+            for (bool changed = true; changed;)
+            {
+                changed = false;
+                auto relax = [&](int state, double candidate)
+                {
+                    if (candidate < cost[state])
+                    {
+                        cost[state] = candidate;
+                        changed = true;
+                    }
+                };
+                for (const auto &edge : edges)
+                {
+                    for (int mode = 0; mode < TravelModeCount; ++mode)
+                    {
+                        relax(edge.first.second * TravelModeCount + mode, cost[edge.first.first * TravelModeCount + mode] + rules.costFactor[mode] * edge.second);
+                    }
+                }
+                for (int v = 0; v < smallNodes; ++v)
+                {
+                    for (int mode = 0; mode < TravelModeCount; ++mode)
+                    {
+                        for (int other = 0; other < TravelModeCount; ++other)
+                        {
+                            relax(v * TravelModeCount + other, cost[v * TravelModeCount + mode] + rules.boardingPenalty(types[smallTypes[v]], TravelMode(other)));
+                        }
+                    }
+                }
+            }
+            for (int target = 0; target < smallNodes; ++target)
+            {
+                double expected = *min_element(cost.begin() + target * TravelModeCount, cost.begin() + (target + 1) * TravelModeCount);
+                double found = small.findMultimodalRoute(source + 1, target + 1, rules).cost;
+                bruteForceMismatches += !(found == expected || fabs(found - expected) <= 1e-9 * max(1.0, expected));
+                ++bruteForceQueries;
+            }
+        }
+    }
+    cout << "  Bellman-Ford check:   " << bruteForceQueries << " queries on " << smallNodes << "-node graphs, " << bruteForceMismatches << " mismatches" << endl;
+    return mismatches + bruteForceMismatches;
+}
+
+// Benchmark suite over the generated layouts, meant to be tracked across releases. The
+// same random queries run one by one (best path) and as one batch; all paths are
+// enumerated on a small city of each layout. Progress goes to stderr and a JSON report
+// to stdout:
+//   ./main bench suite 1000000 1 > results.json
+// With the same arguments the graphs, queries and route checksums are identical on
+// every run, so only the timings may differ.
+void benchmarkSuite(int nodeCount, unsigned seed, int queryCount)
+{
+    const int allPathsNodes = 25;    // all-paths enumeration is exponential: small cities only
+    const size_t maxPaths = 2000000; // stop enumerating after this many paths
+    int threads = max(1u, thread::hardware_concurrency());
+    cerr << "Benchmark suite: " << nodeCount << " nodes, seed " << seed << ", " << queryCount << " queries, " << threads << " threads" << endl;
+
+    cout.precision(12);
+    cout << "{" << endl;
+    cout << "  \"schema\": 1," << endl;
+    cout << "  \"nodes\": " << nodeCount << "," << endl;
+    cout << "  \"seed\": " << seed << "," << endl;
+    cout << "  \"queries\": " << queryCount << "," << endl;
+    cout << "  \"threads\": " << threads << "," << endl;
+    cout << "  \"layouts\": [" << endl;
+    for (int layout = GridCity; layout <= RandomGeometricCity; ++layout)
+    {
+        const char *name = cityLayoutNames[layout];
+        auto start = chrono::steady_clock::now();
+        CityGraph graph;
+        generateCity(graph, CityLayout(layout), nodeCount, seed);
+        int edgeCount = graph.edgeCount(); // also builds the CSR form
+        double buildSeconds = secondsSince(start);
+
+        mt19937 gen(seed + layout);
+        vector<pair<int, int>> queries;
+        for (int q = 0; q < queryCount; ++q)
+        {
+            queries.push_back(make_pair(1 + gen() % nodeCount, 1 + gen() % nodeCount));
+        }
+
+        SearchStats stats;
+        double routeChecksum = 0.0;
+        int reachable = 0;
+        start = chrono::steady_clock::now();
+        for (int q = 0; q < queryCount; ++q)
+        {
+            vector<int> path = graph.findBestPath(queries[q].first, queries[q].second, &stats);
+            if (!path.empty())
+            {
+                ++reachable;
+                routeChecksum += graph.calculateConvenienceScore(path);
+            }
+        }
+        double bestPathSeconds = secondsSince(start);
+
+        start = chrono::steady_clock::now();
+        vector<RouteResult> results = graph.solveBatch(queries, threads);
+        double batchSeconds = secondsSince(start);
+
+        CityGraph small;
+        generateCity(small, CityLayout(layout), allPathsNodes, seed);
+        size_t pathCount = 0;
+        start = chrono::steady_clock::now();
+        small.forEachPath(1, allPathsNodes, [&](const PathView &)
+                          { return ++pathCount < maxPaths; });
+        double allPathsSeconds = secondsSince(start);
+
+        // Guarded so that no query or a too-fast batch cannot print inf or nan, which
+        // are not JSON
+        int perQuery = max(queryCount, 1);
+        double batchRate = batchSeconds > 0.0 ? queries.size() / batchSeconds : 0.0;
+
+        cerr << "  " << name << ": " << edgeCount << " edges, build " << buildSeconds * 1000 << " ms, best path "
+             << bestPathSeconds / perQuery * 1e6 << " us, batch " << batchRate << " queries/s, "
+             << pathCount << " paths in " << allPathsSeconds * 1000 << " ms" << endl;
+
+        cout << "    {" << endl;
+        cout << "      \"layout\": \"" << name << "\"," << endl;
+        cout << "      \"edges\": " << edgeCount << "," << endl;
+        cout << "      \"build_ms\": " << buildSeconds * 1000 << "," << endl;
+        cout << "      \"build_bytes\": " << graph.storageBytes() << "," << endl;
+        cout << "      \"best_path_us\": " << bestPathSeconds / perQuery * 1e6 << "," << endl;
+        cout << "      \"best_path_settled\": " << stats.nodesExpanded / perQuery << "," << endl;
+        cout << "      \"best_path_reachable\": " << reachable << "," << endl;
+        cout << "      \"route_checksum\": " << routeChecksum << "," << endl;
+        cout << "      \"batch_queries\": " << queries.size() << "," << endl;
+        cout << "      \"batch_ms\": " << batchSeconds * 1000 << "," << endl;
+        cout << "      \"batch_queries_per_s\": " << batchRate << "," << endl;
+        cout << "      \"all_paths_nodes\": " << allPathsNodes << "," << endl;
+        cout << "      \"all_paths_count\": " << pathCount << "," << endl;
+        cout << "      \"all_paths_capped\": " << (pathCount >= maxPaths ? "true" : "false") << "," << endl;
+        cout << "      \"all_paths_ms\": " << allPathsSeconds * 1000 << endl;
+        cout << "    }" << (layout < RandomGeometricCity ? "," : "") << endl;
+    }
+    cout << "  ]" << endl;
+    cout << "}" << endl;
+}
+
+// Reachability index on a sparse random city where many pairs have no path: build cost,
+// then best-path queries with the O(1) rejection against plain Dijkstra on the same CSR,
+// then edges added one at a time between queries (the index is patched in place)
+void benchmarkReachability(int nodeCount, int edgesPerNode, int queryCount)
+{
+    cout << "Reachability benchmark: " << nodeCount << " nodes, " << edgesPerNode << " edges/node, " << queryCount << " queries" << endl;
+    CityGraph graph;
+    for (int i = 1; i <= nodeCount; ++i)
+    {
+        graph.addNode(i, "Bus Stop");
+    }
+    mt19937 gen(23);
+    auto randomEdge = [&]()
+    {
+        graph.addEdge(1 + gen() % nodeCount, 1 + gen() % nodeCount, Dlower + gen() % (Dupper - Dlower + 1), Tlower + gen() % (Tupper - Tlower + 1), RLlower + gen() % (RLupper - RLlower + 1));
+    };
+    for (int i = 0; i < nodeCount * edgesPerNode; ++i)
+    {
+        randomEdge();
+    }
+    graph.publish();
+    SnapshotReader reader = graph.readSnapshot();
+    const CompactCityGraph &base = reader->graph;
+
+    auto start = chrono::steady_clock::now();
+    const ReachabilityIndex &index = graph.reachabilityIndex();
+    double buildSeconds = secondsSince(start);
+    cout << "  index:        " << index.componentCount << " components, " << (index.exact() ? "exact closure" : "interval labels") << ", "
+         << index.memoryBytes() / (1024.0 * 1024.0) << " MiB, built in " << buildSeconds * 1000 << " ms" << endl;
+
+    vector<pair<int, int>> queries;
+    for (int q = 0; q < queryCount; ++q)
+    {
+        queries.push_back(make_pair(1 + gen() % nodeCount, 1 + gen() % nodeCount));
+    }
+    int unreachable = 0;
+    int rejected = 0;
+    start = chrono::steady_clock::now();
+    for (const auto &query : queries)
+    {
+        rejected += !graph.reachabilityIndex().mayReach(query.first - 1, query.second - 1);
+        unreachable += graph.findBestEdgePath(query.first, query.second).start == -1;
+    }
+    double indexedSeconds = secondsSince(start);
+    EdgePath path;
+    start = chrono::steady_clock::now();
+    for (const auto &query : queries)
+    {
+        base.shortestPath(query.first - 1, query.second - 1, nullptr, nullptr, path);
+    }
+    double plainSeconds = secondsSince(start);
+    cout << "  queries:      " << unreachable << " of " << queryCount << " without a path, " << rejected << " rejected by the index" << endl;
+    cout << "  with index:   " << indexedSeconds / queryCount * 1e6 << " us/query" << endl;
+    cout << "  plain:        " << plainSeconds / queryCount * 1e6 << " us/query" << endl;
+
+    const int additions = 200;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < additions; ++i)
+    {
+        randomEdge();
+        graph.reachabilityIndex();
+    }
+    cout << "  addEdge:      " << secondsSince(start) / additions * 1e6 << " us per edge with the index kept current" << endl;
+}
+
+// Isochrones on a generated grid city: for growing budgets, the nodes reached and the
+// query time, which follows the reached area rather than the size of the city
+void benchmarkIsochrone(int nodeCount, int queryCount)
+{
+    cout << "Isochrone benchmark: " << nodeCount << " nodes, " << queryCount << " queries per budget" << endl;
+    CityGraph graph;
+    generateCity(graph, GridCity, nodeCount, 1);
+    mt19937 gen(24);
+    vector<int> starts;
+    for (int q = 0; q < queryCount; ++q)
+    {
+        starts.push_back(1 + gen() % nodeCount);
+    }
+    vector<pair<int, double>> reached;
+    graph.isochrone(starts[0], 0.0, reached); // sizes the workspace
+
+    const double budgets[] = {1.0, 4.0, 16.0, 64.0};
+    const int distanceBudgets[] = {10, 40, 160, 640};
+    for (int metric = ConvenienceMetric; metric <= DistanceMetric; ++metric)
+    {
+        for (int b = 0; b < 4; ++b)
+        {
+            double budget = metric == DistanceMetric ? distanceBudgets[b] : budgets[b];
+            size_t total = 0;
+            auto start = chrono::steady_clock::now();
+            for (int source : starts)
+            {
+                total += graph.isochrone(source, budget, reached, CostMetric(metric));
+            }
+            double seconds = secondsSince(start);
+            cout << "  " << (metric == DistanceMetric ? "distance" : "convenience") << " <= " << budget << ": " << total / queryCount
+                 << " nodes reached, " << seconds / queryCount * 1e6 << " us/query" << endl;
+        }
+    }
+}
+
+// Many-to-many cost matrices on a generated grid city: one search per origin on the
+// thread pool, then buckets over a contraction hierarchy, checked against each other;
+// the paths kept with the buckets are unpacked and scored against their cells
+int benchmarkCostMatrix(int nodeCount, int size, int threads)
+{
+    cout << "Cost matrix benchmark: " << nodeCount << " nodes, " << size << " x " << size << ", " << threads << " threads" << endl;
+    CityGraph graph;
+    generateCity(graph, GridCity, nodeCount, 1);
+    mt19937 gen(25);
+    vector<int> origins;
+    vector<int> destinations;
+    for (int i = 0; i < size; ++i)
+    {
+        origins.push_back(1 + gen() % nodeCount);
+        destinations.push_back(1 + gen() % nodeCount);
+    }
+    ThreadPool pool(threads);
+
+    auto start = chrono::steady_clock::now();
+    CostMatrix searched = graph.costMatrix(origins, destinations, pool);
+    cout << "  per-origin search:  " << secondsSince(start) * 1000 << " ms" << endl;
+
+    start = chrono::steady_clock::now();
+    graph.buildContractionHierarchy();
+    cout << "  hierarchy built in  " << secondsSince(start) * 1000 << " ms" << endl;
+    start = chrono::steady_clock::now();
+    CostMatrix bucketed = graph.costMatrix(origins, destinations, pool);
+    cout << "  hierarchy buckets:  " << secondsSince(start) * 1000 << " ms" << endl;
+    start = chrono::steady_clock::now();
+    CostMatrix withPaths = graph.costMatrix(origins, destinations, pool, true);
+    cout << "  buckets with paths: " << secondsSince(start) * 1000 << " ms" << endl;
+
+    // Unpacking is paid per path asked for; here every cell's path is built and scored
+    int mismatches = 0;
+    size_t pathNodes = 0;
+    size_t pathCount = 0;
+    start = chrono::steady_clock::now();
+    for (int row = 0; row < size; ++row)
+    {
+        for (int column = 0; column < size; ++column)
+        {
+            vector<int> path = graph.matrixPath(withPaths, row, column);
+            pathNodes += path.size();
+            pathCount += !path.empty();
+        }
+    }
+    cout << "  unpack every path:  " << secondsSince(start) * 1000 << " ms, " << pathNodes / max(pathCount, size_t(1)) << " nodes/path" << endl;
+    for (int row = 0; row < size; row += 37)
+    {
+        for (int column = 0; column < size; ++column)
+        {
+            vector<int> path = graph.matrixPath(withPaths, row, column);
+            double cost = path.empty() ? numeric_limits<double>::infinity() : graph.calculateConvenienceScore(path);
+            double expected = withPaths.at(row, column);
+            mismatches += !(cost == expected || fabs(cost - expected) <= 1e-9 * max(1.0, expected));
+        }
+    }
+
+    for (size_t cell = 0; cell < searched.costs.size(); ++cell)
+    {
+        double a = searched.costs[cell];
+        double b = bucketed.costs[cell];
+        mismatches += !(a == b || fabs(a - b) <= 1e-9 * max(1.0, a));
+    }
+    cout << "  " << mismatches << " mismatches" << endl;
+    return mismatches;
+}
+
+// Yen's k best paths against exhaustive enumeration (findTopPaths) on small random
+// graphs, where every simple path can still be listed
+int benchmarkKBestPaths(int nodeCount, int k, int queryCount)
+{
+    cout << "K best paths benchmark: " << nodeCount << " nodes, 3 edges per node, k = " << k << ", " << queryCount << " queries" << endl;
+    CityGraph graph;
+    for (int i = 1; i <= nodeCount; ++i)
+    {
+        graph.addNode(i, "Bus Stop");
+    }
+    mt19937 gen(43);
+    for (int i = 1; i <= nodeCount; ++i)
+    {
+        for (int e = 0; e < 3; ++e)
+        {
+            graph.addEdge(i, 1 + gen() % nodeCount, Dlower + gen() % (Dupper - Dlower + 1), Tlower + gen() % (Tupper - Tlower + 1), RLlower + gen() % (RLupper - RLlower + 1));
+        }
+    }
+    vector<pair<int, int>> queries;
+    for (int q = 0; q < queryCount; ++q)
+    {
+        queries.push_back(make_pair(1 + gen() % nodeCount, 1 + gen() % nodeCount));
+    }
+
+    vector<vector<pair<double, vector<int>>>> expected;
+    auto start = chrono::steady_clock::now();
+    for (const auto &query : queries)
+    {
+        expected.push_back(graph.findTopPaths(query.first, query.second, k));
+    }
+    double exhaustiveSeconds = secondsSince(start);
+
+    int mismatches = 0;
+    size_t pathCount = 0;
+    start = chrono::steady_clock::now();
+    for (size_t q = 0; q < queries.size(); ++q)
+    {
+        vector<pair<double, vector<int>>> paths = graph.kBestPaths(queries[q].first, queries[q].second, k);
+        pathCount += paths.size();
+        // Ties may come in either order, so only the costs are compared
+        bool same = paths.size() == expected[q].size();
+        for (size_t i = 0; same && i < paths.size(); ++i)
+        {
+            same = fabs(paths[i].first - expected[q][i].first) <= 1e-9 * max(1.0, paths[i].first);
+        }
+        mismatches += !same;
+    }
+    double yenSeconds = secondsSince(start);
+    cout << "  exhaustive enumeration: " << exhaustiveSeconds / max(queryCount, 1) * 1e6 << " us/query" << endl;
+    cout << "  Yen:                    " << yenSeconds / max(queryCount, 1) * 1e6 << " us/query, "
+         << pathCount << " paths, " << mismatches << " mismatches" << endl;
+    return mismatches;
+}
+
+// Instrumented run of the main query kinds on a generated grid city. Needs a build with
+// -DCITY_PROFILE: metrics go to stderr every second and at the end, and the traced
+// scopes to a Chrome trace file (open it in chrome://tracing or ui.perfetto.dev):
+//   g++ -O2 -DCITY_PROFILE main.cpp -o main && ./main bench profile 100000 1000 trace.json
+void benchmarkProfile(int nodeCount, int queryCount, const char *tracePath)
+{
+#ifdef CITY_PROFILE
+    // Swallows the output of findAllPaths but keeps its formatting cost
+    class NullBuffer : public streambuf
+    {
+    protected:
+        int overflow(int c) override
+        {
+            return c;
+        }
+    };
+
+    cerr << "Profile: " << nodeCount << " nodes, " << queryCount << " queries" << endl;
+    PeriodicMetricsDump dump(cerr, chrono::milliseconds(1000));
+    CityGraph graph;
+    generateCity(graph, GridCity, nodeCount, 1);
+    mt19937 gen(1);
+    vector<pair<int, int>> queries;
+    for (int q = 0; q < queryCount; ++q)
+    {
+        queries.push_back(make_pair(1 + gen() % nodeCount, 1 + gen() % nodeCount));
+    }
+
+    for (const auto &query : queries)
+    {
+        graph.findRouteEdges(query.first, query.second);
+    }
+    graph.solveBatch(queries);
+    graph.precomputeLandmarks();
+    SearchStats stats;
+    for (const auto &query : queries)
+    {
+        graph.findBestEdgePathAStar(query.first, query.second, stats);
+    }
+
+    CityGraph small;
+    generateCity(small, GridCity, 16, 1);
+    NullBuffer sink;
+    streambuf *console = cout.rdbuf(&sink);
+    small.findAllPaths(1, 16);
+    cout.rdbuf(console);
+
+    Profiler::instance().writeMetrics(cerr);
+    ofstream trace(tracePath);
+    Profiler::instance().writeChromeTrace(trace);
+    cerr << "Trace written to " << tracePath << endl;
+#else
+    (void)nodeCount;
+    (void)queryCount;
+    (void)tracePath;
+    cout << "Profiling is compiled out; rebuild with -DCITY_PROFILE" << endl;
+#endif
+}
+
+// Contraction hierarchy on a road-like grid (side x side crossings, two-way streets):
+// preprocessing time, index size and query latency against plain Dijkstra
+void benchmarkContractionHierarchy(int side, int queryCount)
+{
+    int nodeCount = side * side;
+    cout << "Contraction hierarchy benchmark: " << side << " x " << side << " grid, " << queryCount << " queries" << endl;
+    CityGraph graph;
+    for (int i = 1; i <= nodeCount; ++i)
+    {
+        graph.addNode(i, "Bus Stop");
+    }
+    mt19937 gen(29);
+    auto street = [&](int a, int b)
+    {
+        graph.addEdge(a, b, Dlower + gen() % (Dupper - Dlower + 1), Tlower + gen() % (Tupper - Tlower + 1), RLlower + gen() % (RLupper - RLlower + 1));
+        graph.addEdge(b, a, Dlower + gen() % (Dupper - Dlower + 1), Tlower + gen() % (Tupper - Tlower + 1), RLlower + gen() % (RLupper - RLlower + 1));
+    };
+    for (int row = 0; row < side; ++row)
+    {
+        for (int column = 0; column < side; ++column)
+        {
+            int node = row * side + column + 1;
+            if (column + 1 < side)
+            {
+                street(node, node + 1);
+            }
+            if (row + 1 < side)
+            {
+                street(node, node + side);
+            }
+        }
+    }
+
+    auto start = chrono::steady_clock::now();
+    graph.buildContractionHierarchy();
+    double buildSeconds = secondsSince(start);
+    const ContractionHierarchy *hierarchy = graph.contractionHierarchy();
+    cout << "  preprocessing: " << buildSeconds * 1000 << " ms, " << hierarchy->shortcutCount << " shortcuts" << endl;
+    cout << "  index size:    " << hierarchy->memoryBytes() / (1024.0 * 1024.0) << " MiB ("
+         << double(hierarchy->memoryBytes()) / nodeCount << " bytes/node)" << endl;
+
+    vector<pair<int, int>> queries;
+    for (int q = 0; q < queryCount; ++q)
+    {
+        queries.push_back(make_pair(1 + gen() % nodeCount, 1 + gen() % nodeCount));
+    }
+    graph.setRouteCacheCapacity(1);
+
+    vector<double> expected;
+    start = chrono::steady_clock::now();
+    for (const auto &query : queries)
+    {
+        expected.push_back(graph.calculateConvenienceScore(graph.findBestPath(query.first, query.second)));
+    }
+    double dijkstraSeconds = secondsSince(start);
+
+    int mismatches = 0;
+    double checksum = 0.0;
+    start = chrono::steady_clock::now();
+    vector<vector<int>> paths;
+    for (const auto &query : queries)
+    {
+        paths.push_back(graph.findRoute(query.first, query.second));
+    }
+    double hierarchySeconds = secondsSince(start);
+    for (size_t q = 0; q < queries.size(); ++q)
+    {
+        double cost = graph.calculateConvenienceScore(paths[q]);
+        checksum += cost;
+        mismatches += fabs(cost - expected[q]) > 1e-9;
+    }
+    cout << "  Dijkstra query:  " << dijkstraSeconds / queryCount * 1e6 << " us" << endl;
+    cout << "  hierarchy query: " << hierarchySeconds / queryCount * 1e6 << " us (unpacked path), "
+         << mismatches << " mismatches (checksum " << checksum << ")" << endl;
+}
+
+// Bulk CSV import throughput for a growing number of threads. One edge row in a
+// thousand is malformed and has to be rejected without stopping the import.
+void benchmarkImport(int nodeCount, int edgesPerNode, int maxThreads)
+{
+    cout << "Import benchmark: " << nodeCount << " nodes, " << edgesPerNode << " edges per node" << endl;
+    const string nodesPath = "bench_nodes.csv";
+    const string edgesPath = "bench_edges.csv";
+    {
+        ofstream nodes(nodesPath);
+        nodes << "id,type\n";
+        for (int i = 1; i <= nodeCount; ++i)
+        {
+            nodes << i << (i % 3 == 0 ? ",Bus Stop\n" : (i % 3 == 1 ? ",Taxi Stand\n" : ",Auto Stand\n"));
+        }
+        ofstream edges(edgesPath);
+        edges << "source,destination,distance,traffic,redLight\n";
+        mt19937 gen(23);
+        for (long long k = 0; k < (long long)nodeCount * edgesPerNode; ++k)
+        {
+            if (k % 1000 == 999)
+            {
+                edges << "1,2,three,4,5\n";
+                continue;
+            }
+            edges << 1 + gen() % nodeCount << ',' << 1 + gen() % nodeCount << ',' << Dlower + gen() % (Dupper - Dlower + 1) << ','
+                  << Tlower + gen() % (Tupper - Tlower + 1) << ',' << RLlower + gen() % (RLupper - RLlower + 1) << '\n';
+        }
+    }
+
+    for (int threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        CityGraph graph;
+        ImportStats nodes = graph.importNodesCsv(nodesPath, threads);
+        ImportStats edges = graph.importEdgesCsv(edgesPath, threads);
+        cout << "  " << threads << " threads: nodes " << nodes.rowsPerSecond() << " rows/s, edges " << edges.rowsPerSecond()
+             << " rows/s, " << edges.rowsImported << " edges imported, " << edges.rowsRejected << " rows rejected" << endl;
+    }
+    remove(nodesPath.c_str());
+    remove(edgesPath.c_str());
+
+    // A malformed middle row of a trip must end its run: no segment or connection
+    // may skip from the stop before it to the stop after it
+    const string stopsPath = "bench_stops.txt";
+    const string stopTimesPath = "bench_stop_times.txt";
+    {
+        ofstream stops(stopsPath);
+        stops << "stop_id,stop_name\nA,First\nB,Second\nC,Third\n";
+        ofstream stopTimes(stopTimesPath);
+        stopTimes << "trip_id,arrival_time,departure_time,stop_id,stop_sequence\n"
+                  << "T1,08:00:00,08:00:00,A,1\n"
+                  << "T1,08:1x:00,08:10:00,B,2\n"
+                  << "T1,08:20:00,08:20:00,C,3\n"
+                  << "T2,09:00:00,09:00:00,B,1\n"
+                  << "T2,09:10:00,09:10:00,C,2\n";
+    }
+    CityGraph feed;
+    unordered_map<string, int> stopIds;
+    ImportStats gtfs = feed.importGtfs(stopsPath, stopTimesPath, maxThreads, &stopIds);
+    bool skipped = !feed.findBestEdgePath(stopIds["A"], stopIds["C"]).edges.empty();
+    cout << "  GTFS check: " << gtfs.rowsRejected << " row rejected, " << gtfs.edgesAdded << " segment, " << feed.connectionCount()
+         << " connection" << (skipped || gtfs.edgesAdded != 1 || feed.connectionCount() != 1 ? " (WRONG: expected 1 and 1)" : "") << endl;
+    remove(stopsPath.c_str());
+    remove(stopTimesPath.c_str());
+}
+
+// Start-up from a binary graph file against building the graph edge by edge, and
+// query results of the mapped graph against the built one
+void benchmarkMappedGraph(int nodeCount, int edgesPerNode)
+{
+    cout << "Mapped graph benchmark: " << nodeCount << " nodes, " << edgesPerNode << " edges per node" << endl;
+    const string path = "bench_graph.bin";
+    mt19937 gen(17);
+    auto start = chrono::steady_clock::now();
+    CityGraph built;
+    for (int i = 1; i <= nodeCount; ++i)
+    {
+        built.addNode(i, i % 3 == 0 ? "Bus Stop" : (i % 3 == 1 ? "Taxi Stand" : "Auto Stand"));
+    }
+    for (int i = 1; i <= nodeCount; ++i)
+    {
+        for (int k = 0; k < edgesPerNode; ++k)
+        {
+            built.addEdge(i, 1 + gen() % nodeCount, Dlower + gen() % (Dupper - Dlower + 1), Tlower + gen() % (Tupper - Tlower + 1), RLlower + gen() % (RLupper - RLlower + 1));
+        }
+    }
+    built.findBestPath(1, 2); // includes the CSR build
+    cout << "  build edge by edge:   " << secondsSince(start) * 1000 << " ms" << endl;
+
+    start = chrono::steady_clock::now();
+    built.saveBinary(path);
+    cout << "  save:                 " << secondsSince(start) * 1000 << " ms" << endl;
+
+    for (int verify = 0; verify < 2; ++verify)
+    {
+        start = chrono::steady_clock::now();
+        CityGraph loaded;
+        loaded.loadBinary(path, verify);
+        double loadSeconds = secondsSince(start);
+        start = chrono::steady_clock::now();
+        loaded.findBestPath(1, nodeCount);
+        double querySeconds = secondsSince(start);
+        cout << "  load" << (verify ? " + verify:        " : ":                 ") << loadSeconds * 1000 << " ms, first query " << querySeconds * 1000 << " ms" << endl;
+
+        int mismatches = 0;
+        for (int q = 0; q < 50; ++q)
+        {
+            int from = 1 + gen() % nodeCount;
+            int to = 1 + gen() % nodeCount;
+            mismatches += built.findBestPath(from, to) != loaded.findBestPath(from, to);
+        }
+        if (mismatches > 0)
+        {
+            cout << "  " << mismatches << " of 50 queries differ from the built graph" << endl;
+        }
+    }
+    remove(path.c_str());
+}
+
+// Compare the pointer-based adjacency with the CSR form: bytes per edge,
+// a full edge scan (scoring every edge) and a BFS over the whole graph.
+void benchmarkCompactGraph(int nodeCount, int edgesPerNode)
+{
+    cout << "CSR benchmark: " << nodeCount << " nodes, " << edgesPerNode << " edges per node" << endl;
+    vector<CityNode *> nodes = buildRandomNodes(nodeCount, edgesPerNode, 42);
+
+    auto buildStart = chrono::steady_clock::now();
+    CompactCityGraph graph(nodes);
+    double buildSeconds = secondsSince(buildStart);
+    double edgeCount = graph.edgeCount();
+
+    size_t pointerBytes = nodes.capacity() * sizeof(CityNode *);
+    for (CityNode *node : nodes)
+    {
+        pointerBytes += heapBlockBytes(sizeof(CityNode));
+        pointerBytes += heapBlockBytes(node->edges.capacity() * sizeof(CityEdge *));
+        pointerBytes += node->edges.size() * heapBlockBytes(sizeof(CityEdge));
+    }
+
+    cout << "  CSR build time:           " << buildSeconds * 1000 << " ms" << endl;
+    cout << "  pointer graph bytes/edge: " << pointerBytes / edgeCount << endl;
+    cout << "  CSR graph bytes/edge:     " << graph.memoryBytes() / edgeCount << endl;
+
+    const int rounds = 3;
+    double checksum = 0.0;
+
+    auto start = chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round)
+    {
+        for (CityNode *node : nodes)
+        {
+            for (CityEdge *edge : node->edges)
+            {
+                checksum += convenienceCost(edge->info.distance, edge->info.traffic, edge->info.redLight);
+            }
+        }
+    }
+    double pointerScan = secondsSince(start);
+
+    start = chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round)
+    {
+        for (int e = 0; e < graph.edgeCount(); ++e)
+        {
+            checksum -= graph.edgeCost(e);
+        }
+    }
+    double compactScan = secondsSince(start);
+
+    vector<char> visited(nodeCount);
+    vector<int> frontier;
+    frontier.reserve(nodeCount);
+
+    start = chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round)
+    {
+        fill(visited.begin(), visited.end(), 0);
+        frontier.assign(1, 0);
+        visited[0] = 1;
+        for (size_t head = 0; head < frontier.size(); ++head)
+        {
+            for (CityEdge *edge : nodes[frontier[head]]->edges)
+            {
+                if (!visited[edge->destination->index])
+                {
+                    visited[edge->destination->index] = 1;
+                    frontier.push_back(edge->destination->index);
+                }
+            }
+        }
+    }
+    double pointerBfs = secondsSince(start);
+
+    start = chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round)
+    {
+        fill(visited.begin(), visited.end(), 0);
+        frontier.assign(1, 0);
+        visited[0] = 1;
+        for (size_t head = 0; head < frontier.size(); ++head)
+        {
+            int node = frontier[head];
+            for (int e = graph.offsets[node]; e < graph.offsets[node + 1]; ++e)
+            {
+                if (!visited[graph.targets[e]])
+                {
+                    visited[graph.targets[e]] = 1;
+                    frontier.push_back(graph.targets[e]);
+                }
+            }
+        }
+    }
+    double compactBfs = secondsSince(start);
+
+    double scanned = edgeCount * rounds / 1e6;
+    cout << "  edge scan (M edges/s):    pointer " << scanned / pointerScan << ", CSR " << scanned / compactScan << endl;
+    cout << "  BFS       (M edges/s):    pointer " << scanned / pointerBfs << ", CSR " << scanned / compactBfs << endl;
+    cout << "  (checksum " << checksum << ")" << endl;
+
+    deleteNodes(nodes);
+}
+
+// Graph construction cost with the id -> index table, for dense ids (1..N) and
+// sparse ids (random 31-bit ids, hash table path). The old linear findNode scan is
+// timed too while it still finishes in reasonable time.
+void benchmarkConstruction(int maxNodes, int edgesPerNode)
+{
+    cout << "Construction benchmark: " << edgesPerNode << " edges per node" << endl;
+    cout << "  nodes      dense ids    sparse ids   linear findNode" << endl;
+    for (int nodeCount = 1000; nodeCount <= maxNodes; nodeCount *= 10)
+    {
+        mt19937 gen(7);
+        vector<int> sparseIds(nodeCount);
+        unordered_set<int> used;
+        for (int &id : sparseIds)
+        {
+            do
+            {
+                id = gen() & 0x7fffffff;
+            } while (!used.insert(id).second);
+        }
+        vector<pair<int, int>> edgeList;
+        for (int i = 0; i < nodeCount; ++i)
+        {
+            for (int k = 0; k < edgesPerNode; ++k)
+            {
+                edgeList.push_back(make_pair(i, gen() % nodeCount));
+            }
+        }
+
+        double times[2];
+        for (int sparse = 0; sparse < 2; ++sparse)
+        {
+            auto start = chrono::steady_clock::now();
+            // Freed after its time is taken, before the next graph is built
+            unique_ptr<CityGraph> graph(new CityGraph());
+            for (int i = 0; i < nodeCount; ++i)
+            {
+                graph->addNode(sparse ? sparseIds[i] : i + 1, "Bus Stop");
+            }
+            for (const auto &edge : edgeList)
+            {
+                int source = sparse ? sparseIds[edge.first] : edge.first + 1;
+                int destination = sparse ? sparseIds[edge.second] : edge.second + 1;
+                graph->addEdge(source, destination, Dlower, Tlower, RLlower);
+            }
+            times[sparse] = secondsSince(start);
+        }
+
+        cout << "  " << nodeCount << "\t   " << times[0] * 1000 << " ms\t" << times[1] * 1000 << " ms\t";
+        if (nodeCount <= 10000)
+        {
+            // What addEdge used to do: two linear scans over the node list per edge
+            auto start = chrono::steady_clock::now();
+            vector<CityNode *> nodes;
+            for (int i = 0; i < nodeCount; ++i)
+            {
+                nodes.push_back(new CityNode(i + 1, "Bus Stop"));
+            }
+            auto linearFind = [&](int id) -> CityNode *
+            {
+                for (CityNode *node : nodes)
+                {
+                    if (node->id == id)
+                    {
+                        return node;
+                    }
+                }
+                return nullptr;
+            };
+            for (const auto &edge : edgeList)
+            {
+                CityNode *source = linearFind(edge.first + 1);
+                CityNode *destination = linearFind(edge.second + 1);
+                source->edges.push_back(new CityEdge(source, destination, EdgeInfo(Dlower, Tlower, RLlower)));
+            }
+            cout << secondsSince(start) * 1000 << " ms";
+            deleteNodes(nodes);
+        }
+        else
+        {
+            cout << "skipped";
+        }
+        cout << endl;
+    }
+}
+
+// Score a batch of random walks the old way (find both endpoints, scan the source's
+// edge list, three divisions per hop) and from the cached edge costs of the batch.
+void benchmarkScoring(int pathCount, int pathLength)
+{
+    cout << "Scoring benchmark: " << pathCount << " paths of " << pathLength << " edges" << endl;
+    const int nodeCount = 100000;
+    vector<CityNode *> nodes = buildRandomNodes(nodeCount, 4, 11);
+    CompactCityGraph graph(nodes);
 
-    vector<int> findMostConvenientPath(const vector<vector<int>> &allPaths)
+    mt19937 gen(5);
+    PathBatch batch;
+    vector<vector<int>> idPaths;
+    vector<int> edges;
+    for (int p = 0; p < pathCount; ++p)
     {
-        vector<int> mostConvenientPath;
-        double minConvenienceScore = numeric_limits<double>::infinity();
-
-        for (const auto &path : allPaths)
+        int node = gen() % nodeCount;
+        int start = node;
+        vector<int> ids(1, graph.nodeIds[node]);
+        edges.clear();
+        for (int k = 0; k < pathLength && graph.offsets[node] < graph.offsets[node + 1]; ++k)
         {
-            double convenienceScore = calculateConvenienceScore(path);
-            cout << "convenient score  "<< convenienceScore << endl;
-            if (convenienceScore < minConvenienceScore)
-            {
-                minConvenienceScore = convenienceScore;
-                mostConvenientPath = path;
-            }
+            int e = graph.offsets[node] + gen() % (graph.offsets[node + 1] - graph.offsets[node]);
+            edges.push_back(e);
+            node = graph.targets[e];
+            ids.push_back(graph.nodeIds[node]);
         }
-        cout<<endl;
-        return mostConvenientPath;
+        batch.add(start, edges);
+        idPaths.push_back(ids);
     }
 
-    // Calculate the convenience score for a path
-    double calculateConvenienceScore(const vector<int> &path)
+    auto start = chrono::steady_clock::now();
+    double legacyTotal = 0.0;
+    for (const auto &path : idPaths)
     {
-        double totalScore = 0.0;
-        const double epsilon = 1e-2;
-        for (int  i = 0; i < path.size() - 1; ++i)
+        for (size_t i = 0; i + 1 < path.size(); ++i)
         {
-            CityNode *source = findNode(path[i]);
-            CityNode *destination = findNode(path[i + 1]);
-            if (source && destination)
+            // ids are index + 1 here, standing in for the old findNode lookups
+            CityNode *source = nodes[path[i] - 1];
+            CityNode *destination = nodes[path[i + 1] - 1];
+            for (CityEdge *edge : source->edges)
             {
-                for (CityEdge *edge : source->edges)
+                if (edge->destination == destination)
                 {
-                    if (edge->destination == destination)
-                    {
-                        // Adjust weights to minimize distance, red light, and traffic
-                        totalScore += 0.5 / (edge->info.distance + epsilon) + 0.3 / (edge->info.redLight + epsilon) + 0.2 / (edge->info.traffic + epsilon);
-                        break;
-                    }
+                    legacyTotal += convenienceCost(edge->info.distance, edge->info.traffic, edge->info.redLight);
+                    break;
                 }
             }
         }
+    }
+    double legacySeconds = secondsSince(start);
 
-        return totalScore;
+    start = chrono::steady_clock::now();
+    vector<double> scores;
+    graph.scoreBatch(batch, scores);
+    double batchTotal = 0.0;
+    for (double score : scores)
+    {
+        batchTotal += score;
     }
+    double batchSeconds = secondsSince(start);
 
-    // Display a path
-    void displayPath(const vector<int> &path)
+    cout << "  per-hop lookup: " << legacySeconds * 1000 << " ms (total " << legacyTotal << ")" << endl;
+    cout << "  batch scoring:  " << batchSeconds * 1000 << " ms (total " << batchTotal << ")" << endl;
+    deleteNodes(nodes);
+}
+
+// Sequential against parallel path enumeration on a complete directed graph,
+// checking that every thread count finds exactly the same set of paths.
+void benchmarkParallelPaths(int nodeCount, int maxThreads)
+{
+    cout << "Parallel enumeration benchmark: complete graph with " << nodeCount << " nodes" << endl;
+    CityGraph graph;
+    for (int i = 1; i <= nodeCount; ++i)
     {
-        for (size_t i = 0; i < path.size(); ++i)
+        graph.addNode(i, "Bus Stop");
+    }
+    mt19937 gen(3);
+    for (int i = 1; i <= nodeCount; ++i)
+    {
+        for (int j = 1; j <= nodeCount; ++j)
         {
-            cout << path[i];
-            if (i < path.size() - 1)
+            if (i != j)
             {
-                cout << " -> ";
+                graph.addEdge(i, j, Dlower + gen() % (Dupper - Dlower + 1), Tlower + gen() % (Tupper - Tlower + 1), RLlower + gen() % (RLupper - RLlower + 1));
             }
         }
-
-        cout << endl;
     }
 
-public:
-    vector<vector<int>> allPaths;
-    // Add a new node to the city
-    void addNode(int nodeId, const string &nodeType)
+    auto start = chrono::steady_clock::now();
+    vector<vector<int>> expected = graph.collectAllPaths(1, nodeCount);
+    double sequentialSeconds = secondsSince(start);
+    sort(expected.begin(), expected.end());
+    cout << "  sequential: " << expected.size() << " paths in " << sequentialSeconds * 1000 << " ms" << endl;
+
+    for (int threads = 1; threads <= maxThreads; threads *= 2)
     {
-        CityNode *newNode = new CityNode(nodeId, nodeType);
-        city.push_back(newNode);
+        ThreadPool pool(threads);
+        start = chrono::steady_clock::now();
+        vector<vector<int>> paths = graph.findAllPathsParallel(1, nodeCount, pool);
+        double seconds = secondsSince(start);
+        sort(paths.begin(), paths.end());
+        cout << "  " << threads << " threads: " << seconds * 1000 << " ms, speedup " << sequentialSeconds / seconds
+             << (paths == expected ? ", same paths" : ", MISMATCH") << endl;
     }
+}
 
-    // Add a weighted directed edge from node1 to node2
-    void addEdge(int node1, int node2, int distance, int traffic, int redLight)
+// Plain enumeration against the two branch-and-bound modes on a random graph, with
+// a hop limit so the plain run stays finite.
+void benchmarkBranchAndBound(int nodeCount, int edgesPerNode, int maxHops)
+{
+    cout << "Branch and bound benchmark: " << nodeCount << " nodes, " << edgesPerNode << " edges per node, at most " << maxHops << " hops" << endl;
+    CityGraph graph;
+    for (int i = 1; i <= nodeCount; ++i)
     {
-        CityNode *source = findNode(node1);
-        CityNode *destination = findNode(node2);
-
-        if (source && destination)
+        graph.addNode(i, "Bus Stop");
+    }
+    mt19937 gen(17);
+    for (int i = 1; i <= nodeCount; ++i)
+    {
+        for (int k = 0; k < edgesPerNode; ++k)
         {
-            EdgeInfo edgeInfo(distance, traffic, redLight);
-            CityEdge *newEdge = new CityEdge(source, destination, edgeInfo);
-            source->edges.push_back(newEdge);
+            graph.addEdge(i, 1 + gen() % nodeCount, Dlower + gen() % (Dupper - Dlower + 1), Tlower + gen() % (Tupper - Tlower + 1), RLlower + gen() % (RLupper - RLlower + 1));
         }
     }
 
-    void findAllPaths(int start, int end)
+    const char *names[] = {"plain enumeration ", "incumbent pruning ", "lower-bound pruning"};
+    PruningMode modes[] = {NoPruning, IncumbentPruning, LowerBoundPruning};
+    for (int m = 0; m < 3; ++m)
     {
-        CityNode *startNode = findNode(start);
-        CityNode *endNode = findNode(end);
+        SearchLimits limits;
+        limits.maxHops = maxHops;
+        limits.pruning = modes[m];
+        SearchStats stats;
+        auto start = chrono::steady_clock::now();
+        vector<int> best = graph.findBestPathBounded(1, nodeCount, limits, stats);
+        double seconds = secondsSince(start);
+        cout << "  " << names[m] << ": " << seconds * 1000 << " ms, " << stats.nodesExpanded << " nodes expanded, "
+             << stats.branchesCut << " branches cut, best score " << (best.empty() ? -1.0 : graph.calculateConvenienceScore(best)) << endl;
+    }
+}
 
-        if (!startNode || !endNode)
+// Route table build time (Floyd-Warshall and parallel Dijkstra) and query latency
+// of table lookups against a Dijkstra search per query.
+void benchmarkRouteTable(int nodeCount, int edgesPerNode, int threads)
+{
+    cout << "Route table benchmark: " << nodeCount << " nodes, " << edgesPerNode << " edges per node" << endl;
+    CityGraph graph;
+    for (int i = 1; i <= nodeCount; ++i)
+    {
+        graph.addNode(i, "Bus Stop");
+    }
+    mt19937 gen(23);
+    for (int i = 1; i <= nodeCount; ++i)
+    {
+        for (int k = 0; k < edgesPerNode; ++k)
         {
-            cout << "Invalid start or end node." << endl;
-            return;
+            graph.addEdge(i, 1 + gen() % nodeCount, Dlower + gen() % (Dupper - Dlower + 1), Tlower + gen() % (Tupper - Tlower + 1), RLlower + gen() % (RLupper - RLlower + 1));
         }
+    }
 
-        vector<int> currentPath;
-        unordered_set<int> visitedNodes;
-
-        cout << "All paths from " << startNode->type << startNode->id << " to " << endNode->type << endNode->id << ":" << endl;
-        findAllPathsHelper(startNode, endNode, currentPath, allPaths, visitedNodes);
-
-        // Display all paths
-        for (const auto &path : allPaths)
-        {
-            displayPath(path);
-        }
+    const int queryCount = 2000;
+    vector<pair<int, int>> queries;
+    for (int q = 0; q < queryCount; ++q)
+    {
+        queries.push_back(make_pair(1 + gen() % nodeCount, 1 + gen() % nodeCount));
+    }
 
-        cout << endl
-             << "MOST CONVENIENT PATH  IS";
+    auto start = chrono::steady_clock::now();
+    vector<double> expected;
+    for (const auto &query : queries)
+    {
+        vector<int> path = graph.findRoute(query.first, query.second);
+        expected.push_back(path.empty() ? -1.0 : graph.calculateConvenienceScore(path));
+    }
+    double dijkstraSeconds = secondsSince(start);
+    cout << "  Dijkstra per query:       " << dijkstraSeconds * 1e6 / queryCount << " us/query" << endl;
 
-        cout << endl
-             << endl;
+    AllPairsMethod methods[] = {FloydWarshall, ParallelDijkstra};
+    const char *names[] = {"Floyd-Warshall build:     ", "parallel Dijkstra build:  "};
+    for (int m = 0; m < 2; ++m)
+    {
+        start = chrono::steady_clock::now();
+        graph.precomputeRoutes(methods[m], threads);
+        cout << "  " << names[m] << secondsSince(start) * 1000 << " ms" << endl;
 
-        if (!allPaths.empty())
-        {
-            vector<int> mostConvenientPath = findMostConvenientPath(allPaths);
-            cout << "Most convenient path: ";
-            displayPath(mostConvenientPath);
-        }
-        else
+        int mismatches = 0;
+        start = chrono::steady_clock::now();
+        for (size_t q = 0; q < queries.size(); ++q)
         {
-            cout << "No paths found." << endl;
+            vector<int> path = graph.findRoute(queries[q].first, queries[q].second);
+            double cost = path.empty() ? -1.0 : graph.calculateConvenienceScore(path);
+            mismatches += fabs(cost - expected[q]) > 1e-9;
         }
-
-    
+        double tableSeconds = secondsSince(start);
+        cout << "    table lookup:           " << tableSeconds * 1e6 / queryCount << " us/query, " << mismatches << " mismatches" << endl;
     }
+}
 
-    // Display the graph
-    void displayGraph()
+// Latency percentiles of skewed (Zipf-like) best-path traffic with and without the cache
+void benchmarkRouteCache(int nodeCount, int cacheCapacity, int queryCount)
+{
+    cout << "Route cache benchmark: " << nodeCount << " nodes, capacity " << cacheCapacity << ", " << queryCount << " queries" << endl;
+    CityGraph graph;
+    for (int i = 1; i <= nodeCount; ++i)
     {
-        for (int i = 1; i <= Totalnode ; ++i)
+        graph.addNode(i, "Bus Stop");
+    }
+    mt19937 gen(29);
+    for (int i = 1; i <= nodeCount; ++i)
+    {
+        for (int k = 0; k < 4; ++k)
         {
-            cout << "+------";
+            graph.addEdge(i, 1 + gen() % nodeCount, Dlower + gen() % (Dupper - Dlower + 1), Tlower + gen() % (Tupper - Tlower + 1), RLlower + gen() % (RLupper - RLlower + 1));
         }
-        cout << "+" << endl;
+    }
 
-        for (int i = 1; i <= Totalnode; ++i)
+    // Pair popularity follows 1 / rank
+    const int distinctPairs = 20000;
+    vector<double> weights(distinctPairs);
+    vector<pair<int, int>> pairs(distinctPairs);
+    for (int i = 0; i < distinctPairs; ++i)
+    {
+        weights[i] = 1.0 / (i + 1);
+        pairs[i] = make_pair(1 + gen() % nodeCount, 1 + gen() % nodeCount);
+    }
+    discrete_distribution<int> pickPair(weights.begin(), weights.end());
+    vector<pair<int, int>> queries;
+    for (int q = 0; q < queryCount; ++q)
+    {
+        queries.push_back(pairs[pickPair(gen)]);
+    }
+
+    for (int cached = 0; cached < 2; ++cached)
+    {
+        graph.setRouteCacheCapacity(cacheCapacity);
+        vector<double> latencies;
+        latencies.reserve(queries.size());
+        for (const auto &query : queries)
         {
-            CityNode *node = findNode(i);
-            if (node)
+            auto start = chrono::steady_clock::now();
+            if (!cached)
             {
-                cout << "| " << node->type[0] << i << "  ";
+                graph.findBestPath(query.first, query.second);
             }
             else
             {
-                cout << "| ";
+                graph.findRoute(query.first, query.second);
             }
+            latencies.push_back(secondsSince(start) * 1e6);
         }
-        cout << "|" << endl;
+        sort(latencies.begin(), latencies.end());
+        cout << "  " << (cached ? "with cache:    " : "without cache: ") << "p50 " << latencies[latencies.size() / 2]
+             << " us, p99 " << latencies[latencies.size() * 99 / 100] << " us" << endl;
+    }
+    RouteCacheStats stats = graph.routeCacheStats();
+    cout << "  hits " << stats.hits << ", misses " << stats.misses << ", evictions " << stats.evictions << ", entries " << stats.entries << endl;
+}
 
-        for (int i = 1; i <= Totalnode; ++i)
+// Incremental route table repair after traffic updates against a full rebuild,
+// for growing update batches
+void benchmarkRouteRepair(int nodeCount, int threads)
+{
+    cout << "Route repair benchmark: " << nodeCount << " nodes, 4 edges per node" << endl;
+    CityGraph graph;
+    for (int i = 1; i <= nodeCount; ++i)
+    {
+        graph.addNode(i, "Bus Stop");
+    }
+    mt19937 gen(31);
+    vector<pair<int, int>> edges;
+    for (int i = 1; i <= nodeCount; ++i)
+    {
+        for (int k = 0; k < 4; ++k)
         {
-            cout << "+------";
+            int destination = 1 + gen() % nodeCount;
+            edges.push_back(make_pair(i, destination));
+            graph.addEdge(i, destination, Dlower + gen() % (Dupper - Dlower + 1), Tlower + gen() % (Tupper - Tlower + 1), RLlower + gen() % (RLupper - RLlower + 1));
         }
-        cout << "+" << endl;
+    }
+    graph.precomputeRoutes(ParallelDijkstra, threads);
 
-        cout << endl
-             << endl;
+    for (int batchSize = 1; batchSize <= 10000; batchSize *= 10)
+    {
+        vector<EdgeUpdate> updates;
+        for (int i = 0; i < batchSize; ++i)
+        {
+            const pair<int, int> &edge = edges[gen() % edges.size()];
+            EdgeUpdate update = {edge.first, edge.second, Tlower + int(gen() % (Tupper - Tlower + 1)), RLlower + int(gen() % (RLupper - RLlower + 1))};
+            updates.push_back(update);
+        }
 
-        for (int i = 1; i <= Totalnode; ++i)
+        auto start = chrono::steady_clock::now();
+        size_t changed = graph.updateTraffic(updates, threads);
+        double repairSeconds = secondsSince(start);
+
+        start = chrono::steady_clock::now();
+        graph.precomputeRoutes(ParallelDijkstra, threads);
+        double rebuildSeconds = secondsSince(start);
+
+        cout << "  batch " << batchSize << " (" << changed << " edges changed): updateTraffic " << repairSeconds * 1000
+             << " ms, full rebuild " << rebuildSeconds * 1000 << " ms" << endl;
+    }
+}
+
+// Best-path queries per second on published snapshots for a growing number of
+// reader threads, while a writer keeps applying traffic updates and publishing
+void benchmarkSnapshots(int nodeCount, int maxReaders)
+{
+    cout << "Snapshot benchmark: " << nodeCount << " nodes, writer publishing traffic updates every 5 ms" << endl;
+    CityGraph graph;
+    for (int i = 1; i <= nodeCount; ++i)
+    {
+        graph.addNode(i, "Bus Stop");
+    }
+    mt19937 gen(37);
+    vector<pair<int, int>> edges;
+    for (int i = 1; i <= nodeCount; ++i)
+    {
+        for (int k = 0; k < 4; ++k)
         {
-            CityNode *node = findNode(i);
-            if (node)
-            {
-                vector<CityEdge *> edges = node->edges;
-                for (auto edge : edges)
-                {
-                    cout << node->type[0] << i << " --> ";
+            int destination = 1 + gen() % nodeCount;
+            edges.push_back(make_pair(i, destination));
+            graph.addEdge(i, destination, Dlower + gen() % (Dupper - Dlower + 1), Tlower + gen() % (Tupper - Tlower + 1), RLlower + gen() % (RLupper - RLlower + 1));
+        }
+    }
+    graph.publish();
 
-                    cout << edge->destination->type[0] << edge->destination->id << " (D: " << edge->info.distance
-                         << ", T: " << edge->info.traffic << ", RL: " << edge->info.redLight << ") ";
+    for (int readers = 1; readers <= maxReaders; readers *= 2)
+    {
+        atomic<bool> running(true);
+        atomic<size_t> queries(0);
+        size_t publishes = 0;
+        double publishSeconds = 0.0;
+        vector<thread> threads;
+        for (int r = 0; r < readers; ++r)
+        {
+            threads.push_back(thread([&graph, &running, &queries, nodeCount, r]()
+                                     {
+                                         mt19937 local(r);
+                                         size_t done = 0;
+                                         while (running)
+                                         {
+                                             graph.findBestPathConcurrent(1 + local() % nodeCount, 1 + local() % nodeCount);
+                                             ++done;
+                                         }
+                                         queries += done;
+                                     }));
+        }
 
-                    cout << endl;
-                }
-                cout << endl;
-            }
-            else
+        auto start = chrono::steady_clock::now();
+        while (secondsSince(start) < 1.0)
+        {
+            vector<EdgeUpdate> updates;
+            for (int i = 0; i < 100; ++i)
             {
-                cout << "                 " << endl;
+                const pair<int, int> &edge = edges[gen() % edges.size()];
+                EdgeUpdate update = {edge.first, edge.second, Tlower + int(gen() % (Tupper - Tlower + 1)), RLlower + int(gen() % (RLupper - RLlower + 1))};
+                updates.push_back(update);
             }
+            auto update = chrono::steady_clock::now();
+            graph.updateTraffic(updates);
+            publishSeconds += secondsSince(update);
+            ++publishes;
+            this_thread::sleep_for(chrono::milliseconds(5));
         }
-
-        for (int i = 1; i <= Totalnode; ++i)
+        running = false;
+        for (thread &reader : threads)
         {
-            cout << "+-----------------";
+            reader.join();
         }
-        cout << "+" << endl;
+        double seconds = secondsSince(start);
+        cout << "  " << readers << " readers: " << queries / seconds << " queries/s, " << publishes << " snapshots published, "
+             << publishSeconds / publishes * 1000 << " ms per update and publish" << endl;
     }
-};
-
-int generateRandomNumber(int lower, int upper)
-{
-
-    static random_device rd;
-    static mt19937 gen(rd());
-    uniform_int_distribution<int> distribution(lower, upper);
-    return distribution(gen);
 }
 
-void createCity(CityGraph &city)
+// Throughput of solveBatch for a growing number of threads against one
+// findBestEdgePath call per query; any mismatch fails the run
+int benchmarkBatchQueries(int nodeCount, int queryCount, int maxThreads)
 {
+    cout << "Batch query benchmark: " << nodeCount << " nodes, " << queryCount << " queries from " << queryCount / 50 << " origins" << endl;
+    CityGraph graph;
+    for (int i = 1; i <= nodeCount; ++i)
+    {
+        graph.addNode(i, "Bus Stop");
+    }
+    mt19937 gen(41);
+    for (int i = 1; i <= nodeCount; ++i)
+    {
+        for (int k = 0; k < 4; ++k)
+        {
+            graph.addEdge(i, 1 + gen() % nodeCount, Dlower + gen() % (Dupper - Dlower + 1), Tlower + gen() % (Tupper - Tlower + 1), RLlower + gen() % (RLupper - RLlower + 1));
+        }
+    }
 
-    int Dlower = 3;
-    int Dupper = 10;
-    int RLlower = 0;
-    int RLupper = 4;
-    int Tlower = 2;
-    int Tupper = 8;
-
-
-    city.addEdge(1, 2, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
-    city.addEdge(2, 1, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
-    city.addEdge(1, 5, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
-    city.addEdge(2, 5, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
-    city.addEdge(2, 4, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
-    city.addEdge(3, 4, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
-    city.addEdge(3, 6, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
-    city.addEdge(4, 3, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
-    city.addEdge(4 ,6, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
-    city.addEdge(5, 2, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
-    city.addEdge(5, 3, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
-    city.addEdge(6, 5, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
-    city.addEdge(6, 4, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
-    city.addEdge(6, 7, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
-    city.addEdge(5,7, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
-    city.addEdge(3,7, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
-    city.addEdge(7,4, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
-    city.addEdge(7,6, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
-    city.addEdge(2,7, generateRandomNumber(Dlower, Dupper), generateRandomNumber(Tlower, Tupper), generateRandomNumber(RLlower, RLupper));
+    vector<int> origins;
+    for (int i = 0; i < max(1, queryCount / 50); ++i)
+    {
+        origins.push_back(1 + gen() % nodeCount);
+    }
+    vector<pair<int, int>> queries;
+    for (int q = 0; q < queryCount; ++q)
+    {
+        queries.push_back(make_pair(origins[gen() % origins.size()], 1 + gen() % nodeCount));
+    }
 
+    const int sampleCount = min(queryCount, 500);
+    auto start = chrono::steady_clock::now();
+    vector<double> expected;
+    for (int q = 0; q < sampleCount; ++q)
+    {
+        EdgePath path = graph.findBestEdgePath(queries[q].first, queries[q].second);
+        expected.push_back(path.start == -1 ? numeric_limits<double>::infinity() : graph.calculateConvenienceScore(path));
+    }
+    cout << "  one query at a time: " << sampleCount / secondsSince(start) << " queries/s" << endl;
 
+    int totalMismatches = 0;
+    for (int threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        ThreadPool pool(threads);
+        start = chrono::steady_clock::now();
+        vector<RouteResult> results = graph.solveBatch(queries.data(), queries.size(), pool);
+        double seconds = secondsSince(start);
+        int mismatches = 0;
+        for (int q = 0; q < sampleCount; ++q)
+        {
+            bool bothMissing = results[q].path.empty() && expected[q] == numeric_limits<double>::infinity();
+            mismatches += !bothMissing && fabs(results[q].cost - expected[q]) > 1e-9;
+        }
+        cout << "  solveBatch, " << threads << " threads: " << queryCount / seconds << " queries/s, " << mismatches << " mismatches" << endl;
+        totalMismatches += mismatches;
+    }
+    return totalMismatches;
 }
 
+int runBenchmarks(int argc, char *argv[])
+{
+    string name = argc > 2 ? argv[2] : "";
+    vector<int> args;
+    for (int i = 3; i < argc; ++i)
+    {
+        args.push_back(atoi(argv[i]));
+    }
+    auto arg = [&](size_t i, int fallback)
+    {
+        return i < args.size() ? args[i] : fallback;
+    };
 
+    if (name == "csr")
+    {
+        benchmarkCompactGraph(arg(0, 1000000), arg(1, 4));
+    }
+    else if (name == "construction")
+    {
+        benchmarkConstruction(arg(0, 1000000), arg(1, 2));
+    }
+    else if (name == "scoring")
+    {
+        benchmarkScoring(arg(0, 100000), arg(1, 32));
+    }
+    else if (name == "parallel")
+    {
+        benchmarkParallelPaths(arg(0, 11), arg(1, 32));
+    }
+    else if (name == "branchbound")
+    {
+        benchmarkBranchAndBound(arg(0, 300), arg(1, 4), arg(2, 14));
+    }
+    else if (name == "allpairs")
+    {
+        benchmarkRouteTable(arg(0, 1000), arg(1, 4), arg(2, thread::hardware_concurrency()));
+    }
+    else if (name == "cache")
+    {
+        benchmarkRouteCache(arg(0, 5000), arg(1, 4096), arg(2, 20000));
+    }
+    else if (name == "repair")
+    {
+        benchmarkRouteRepair(arg(0, 2000), arg(1, thread::hardware_concurrency()));
+    }
+    else if (name == "snapshot")
+    {
+        benchmarkSnapshots(arg(0, 20000), arg(1, 8));
+    }
+    else if (name == "ch")
+    {
+        benchmarkContractionHierarchy(arg(0, 200), arg(1, 1000));
+    }
+    else if (name == "astar")
+    {
+        benchmarkAStar(arg(0, 300), arg(1, 200));
+    }
+    else if (name == "transit")
+    {
+        benchmarkTransit(arg(0, 20000), arg(1, 1000), arg(2, 1000));
+    }
+    else if (name == "multimodal")
+    {
+        return benchmarkMultimodal(arg(0, 200000), arg(1, 4), arg(2, 100)) > 0;
+    }
+    else if (name == "suite")
+    {
+        benchmarkSuite(arg(0, 100000), arg(1, 1), arg(2, 1000));
+    }
+    else if (name == "reach")
+    {
+        benchmarkReachability(arg(0, 100000), arg(1, 1), arg(2, 2000));
+    }
+    else if (name == "isochrone")
+    {
+        benchmarkIsochrone(arg(0, 1000000), arg(1, 100));
+    }
+    else if (name == "matrix")
+    {
+        return benchmarkCostMatrix(arg(0, 100000), arg(1, 1000), arg(2, thread::hardware_concurrency())) > 0;
+    }
+    else if (name == "kbest")
+    {
+        return benchmarkKBestPaths(arg(0, 20), arg(1, 20), arg(2, 200)) > 0;
+    }
+    else if (name == "profile")
+    {
+        benchmarkProfile(arg(0, 100000), arg(1, 200), argc > 5 ? argv[5] : "trace.json");
+    }
+    else if (name == "import")
+    {
+        benchmarkImport(arg(0, 500000), arg(1, 4), arg(2, 4));
+    }
+    else if (name == "mapped")
+    {
+        benchmarkMappedGraph(arg(0, 1000000), arg(1, 4));
+    }
+    else if (name == "arena")
+    {
+        benchmarkArena(arg(0, 1000000), arg(1, 4));
+    }
+    else if (name == "batch")
+    {
+        return benchmarkBatchQueries(arg(0, 20000), arg(1, 20000), arg(2, 8)) > 0;
+    }
+    else
+    {
+        cout << "Available benchmarks:" << endl;
+        cout << "  csr [nodes] [edgesPerNode]" << endl;
+        cout << "  construction [maxNodes] [edgesPerNode]" << endl;
+        cout << "  scoring [paths] [pathLength]" << endl;
+        cout << "  parallel [nodes] [maxThreads]" << endl;
+        cout << "  branchbound [nodes] [edgesPerNode] [maxHops]" << endl;
+        cout << "  allpairs [nodes] [edgesPerNode] [threads]" << endl;
+        cout << "  cache [nodes] [capacity] [queries]" << endl;
+        cout << "  repair [nodes] [threads]" << endl;
+        cout << "  snapshot [nodes] [maxReaders]" << endl;
+        cout << "  batch [nodes] [queries] [maxThreads]" << endl;
+        cout << "  arena [nodes] [edgesPerNode]" << endl;
+        cout << "  mapped [nodes] [edgesPerNode]" << endl;
+        cout << "  import [nodes] [edgesPerNode] [maxThreads]" << endl;
+        cout << "  ch [gridSide] [queries]" << endl;
+        cout << "  astar [gridSide] [queries]" << endl;
+        cout << "  transit [stops] [lines] [queries]" << endl;
+        cout << "  multimodal [nodes] [edgesPerNode] [queries]" << endl;
+        cout << "  suite [nodes] [seed] [queries]   (JSON report on stdout)" << endl;
+        cout << "  profile [nodes] [queries] [traceFile]   (build with -DCITY_PROFILE)" << endl;
+        cout << "  reach [nodes] [edgesPerNode] [queries]" << endl;
+        cout << "  isochrone [nodes] [queries]" << endl;
+        cout << "  matrix [nodes] [size] [threads]" << endl;
+        cout << "  kbest [nodes] [k] [queries]" << endl;
+        return 1;
+    }
+    return 0;
+}
 
-int main()
+int main(int argc, char *argv[])
 {
+    if (argc > 1 && string(argv[1]) == "bench")
+    {
+        return runBenchmarks(argc, argv);
+    }
+
     CityGraph city;
 
-    // Add 15 city nodes with different types
-    for (int i = 1; i <= Totalnode; ++i)
+    if (argc > 2 && string(argv[1]) == "--graph")
     {
-        string nodeType;
-        if (i % 3 == 0)
+        // Start from a graph file written with --save instead of the built-in city
+        try
         {
-            nodeType = "Bus Stop";
+            city.loadBinary(argv[2]);
         }
-        else if (i % 3 == 1)
+        catch (const runtime_error &error)
         {
-            nodeType = "Taxi Stand";
+            cerr << error.what() << endl;
+            return 1;
         }
-        else
+    }
+    else
+    {
+        // Add 15 city nodes with different types
+        for (int i = 1; i <= Totalnode; ++i)
+        {
+            string nodeType;
+            if (i % 3 == 0)
+            {
+                nodeType = "Bus Stop";
+            }
+            else if (i % 3 == 1)
+            {
+                nodeType = "Taxi Stand";
+            }
+            else
+            {
+                nodeType = "Auto Stand";
+            }
+            city.addNode(i, nodeType);
+        }
+
+        if (argc > 2 && string(argv[1]) == "--seed")
         {
-            nodeType = "Auto Stand";
+            // Same edge weights on every run with this seed
+            seedRandomNumbers(atoi(argv[2]));
+        }
+        createCity(city);
+        city.precomputeRoutes();
+        if (argc > 2 && string(argv[1]) == "--save")
+        {
+            city.saveBinary(argv[2]);
         }
-        city.addNode(i, nodeType);
     }
 
-    createCity(city);
-
     // Display the graph
     city.displayGraph();
     cout << endl
@@ -353,11 +8381,13 @@ int main()
     cout << "Enter Choice" << endl;
     cout << "1. Show the path between 2 nodes" << endl;
     cout << "2. Exit" << endl;
+    cout << "3. Show only the most convenient path" << endl;
+    cout << "4. Show the 3 most convenient alternatives" << endl;
     cin >> choice;
 
     while (choice != 2)
     {
-        if (choice == 1)
+        if (choice == 1 || choice == 3 || choice == 4)
         {
             int start, end;
             cout << "Enter the starting position (1-7): ";
@@ -387,27 +8417,43 @@ int main()
                 continue;
             }
 
-            // Find and display all paths between the start and end positions
-            city.findAllPaths(start, end);
-
-            if (city.allPaths.empty())
+            if (choice == 3)
             {
-                cout << "No paths found between nodes " << start << " and " << end << "." << endl;
+                // Dijkstra query, no path enumeration
+                city.showBestPath(start, end);
+            }
+            else if (choice == 4)
+            {
+                city.showBestPaths(start, end, 3);
+            }
+            else
+            {
+                // Find and display all paths between the start and end positions
+                if (city.findAllPaths(start, end) == 0)
+                {
+                    cout << "No paths found between nodes " << start << " and " << end << "." << endl;
+                }
             }
-
-            city.allPaths.clear();
         }
         else
         {
-            cout << "Invalid choice. Please enter 1 or 2." << endl;
+            cout << "Invalid choice. Please enter a number between 1 and 4." << endl;
         }
 
         cout << endl
              << "Enter Choice" << endl;
         cout << "1. Show the path between 2 nodes" << endl;
         cout << "2. Exit" << endl;
+        cout << "3. Show only the most convenient path" << endl;
+        cout << "4. Show the 3 most convenient alternatives" << endl;
         cin >> choice;
     }
 
+#ifdef CITY_PROFILE
+    // Counters and timings of the session
+    ofstream trace("trace.json");
+    Profiler::instance().writeChromeTrace(trace);
+    Profiler::instance().writeMetrics(cerr);
+#endif
     return 0;
 }
\ No newline at end of file